@@ -6,12 +6,35 @@
 #include <sys/wait.h>
 #include <iomanip>
 #include "Commands.h"
+#include "signals.h"
+#include "smash_shm.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+#include <linux/fs.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <vector>
+#include <fstream>
 
 using namespace std;
 
+extern char** environ;
+
 const std::string WHITESPACE = " \n\r\t\f\v";
 
 #if 0
@@ -54,53 +77,119 @@ bool _isBackgroundComamnd(const char* cmd_line) {
   return str[str.find_last_not_of(WHITESPACE)] == '&';
 }
 
-void _removeBackgroundSign(char* cmd_line) {
-  const string str(cmd_line);
-  // find last character other than spaces
-  size_t idx = str.find_last_not_of(WHITESPACE);
-  // if all characters are spaces then return
-  if (idx == string::npos) {
-    return;
+static inline bool _isWhitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v';
+}
+
+// where bash would see `token` as an operator: not inside '...' or "..." and not escaped with a
+// backslash. Searching from `from` assumes no quote is open there. npos if there is none
+static size_t _findUnquoted(const std::string& s, const char* token, size_t from = 0) {
+  size_t length = strlen(token);
+  char quote = '\0';
+  for (size_t i = from; i < s.length(); ++i) {
+    char c = s[i];
+    if (quote == '\'') {
+      quote = (c == '\'') ? '\0' : quote;
+    } else if (c == '\\') {
+      ++i;
+    } else if (quote == '"') {
+      quote = (c == '"') ? '\0' : quote;
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+    } else if (s.compare(i, length, token) == 0) {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+
+// characters that make a command line need bash (globs, quotes, expansions, operators, comments)
+const std::string BASH_SPECIAL_CHARS = "*?[]{}~$'\"\\`;&|<>()#!";
+
+// bash keywords and builtins that have no standalone binary (or behave differently as one)
+const char* const BASH_ONLY_WORDS[] = {
+        "if", "then", "else", "elif", "fi", "case", "esac", "for", "select", "while", "until", "do", "done",
+        "function", "time", "alias", "unalias", "bind", "break", "builtin", "caller", "command", "compgen",
+        "complete", "compopt", "continue", "declare", "typeset", "local", "readonly", "dirs", "pushd", "popd",
+        "disown", "enable", "eval", "exec", "exit", "logout", "export", "unset", "set", "shopt", "fc",
+        "getopts", "hash", "help", "history", "let", "mapfile", "readarray", "read", "return", "shift",
+        "source", ".", ":", "suspend", "times", "trap", "type", "ulimit", "umask", "wait", "cd", "jobs",
+        "fg", "bg", nullptr
+};
+
+bool _isBashRequired(const char* cmd_line, const char* const* args) {
+  if (args[0] == nullptr) {
+    return true;
   }
-  // if the command line does not end with & then return
-  if (cmd_line[idx] != '&') {
-    return;
+  if (string(cmd_line).find_first_of(BASH_SPECIAL_CHARS) != string::npos) {
+    return true;
   }
-  // replace the & (background sign) with space and then remove all tailing spaces.
-  cmd_line[idx] = ' ';
-  // truncate the command line string up to the last non-space character
-  cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
-}
-
-int _parseCommandLine(const char* cmd_line, char** args) {
-  FUNC_ENTRY()
-  int i = 0;
-  std::istringstream iss(_trim(string(cmd_line)));
-  for(std::string s; iss >> s; ) {
-    args[i] = (char*)malloc(s.length()+1);
-    memset(args[i], 0, s.length()+1);
-    strcpy(args[i], s.c_str());
-    args[++i] = nullptr;
+  if (strchr(args[0], '=') != nullptr) { // VAR=value prefix
+    return true;
   }
-  return i;
-
-  FUNC_EXIT()
+  for (int i = 0; BASH_ONLY_WORDS[i] != nullptr; ++i) {
+    if (strcmp(args[0], BASH_ONLY_WORDS[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
 }
 
 // TODO: Add your implementation for classes in Commands.h 
 
 Command::Command(const char* cmd_line) : cmd_line(string(cmd_line)), 
-				argc(0) {
-		char cmd_line_copy[strlen(cmd_line)+1];
-		strcpy(cmd_line_copy, cmd_line);
-		_removeBackgroundSign(cmd_line_copy);
-		argc = _parseCommandLine(cmd_line_copy, argv);
+				argc(0), argv(inlineArgv), body(inlineArena) {
+		parse();
 	}
 
-Command::~Command() {
-	for (int i = 0; argv[i] != nullptr; ++i) {
-		free(argv[i]);
+// one pass over the line: the trailing background sign is dropped, every word is copied once into the arena
+// followed by a NUL, and the trimmed line itself is stored behind the words. The arena and argv live inside
+// the Command for ordinary lines and move to the heap only when a line outgrows them, so there is no limit.
+void Command::parse() {
+	const char* line = cmd_line.data();
+	size_t begin = 0;
+	size_t end = cmd_line.length();
+	while (begin < end && _isWhitespace(line[begin])) {
+		++begin;
+	}
+	while (end > begin && _isWhitespace(line[end - 1])) {
+		--end;
+	}
+	if (end > begin && line[end - 1] == '&') {
+		--end;
+		while (end > begin && _isWhitespace(line[end - 1])) {
+			--end;
+		}
+	}
+	size_t length = end - begin;
+	char* arena = inlineArena;
+	if (2 * (length + 1) > sizeof(inlineArena)) { // words with their NULs never take more than length+1 bytes
+		spilledArena.resize(2 * (length + 1));
+		arena = spilledArena.data();
+	}
+	body = arena + length + 1;
+	memcpy(body, line + begin, length);
+	body[length] = '\0';
+	size_t capacity = COMMAND_INLINE_ARGS;
+	char* out = arena;
+	for (size_t i = begin; i < end; ) {
+		if (_isWhitespace(line[i])) {
+			++i;
+			continue;
+		}
+		if ((size_t)argc == capacity) { // (length+1)/2 words at most, so this happens once per long line
+			spilledArgv.resize((length + 1) / 2 + 1);
+			memcpy(spilledArgv.data(), inlineArgv, argc * sizeof(char*));
+			argv = spilledArgv.data();
+			capacity = spilledArgv.size() - 1;
+		}
+		argv[argc++] = out;
+		while (i < end && !_isWhitespace(line[i])) {
+			*out++ = line[i++];
+		}
+		*out++ = '\0';
 	}
+	argv[argc] = nullptr;
 }
 
 BuiltInCommand::BuiltInCommand(const char* cmd_line) : 
@@ -183,11 +272,58 @@ void ChangeDirCommand::execute() {
 	free(cwd);
 }
 
-JobsCommand::JobsCommand(const char* cmd_line, JobsList* jobs) : 
-				BuiltInCommand(cmd_line), jobs(jobs) {}
+JobsCommand::JobsCommand(const char* cmd_line, JobsList* jobs, JobMonitor* monitor) :
+				BuiltInCommand(cmd_line), jobs(jobs), monitor(monitor), verbose(false), live(false) {
+	verbose = (getArgCount() > 1 && strcmp(getArg(1), "-v") == 0);
+	live = (getArgCount() > 1 && strcmp(getArg(1), "-l") == 0);
+}
 
 void JobsCommand::execute() { 
-	jobs->printJobsList();  
+	jobs->printJobsList(live ? monitor : nullptr, verbose);
+	if (verbose) {
+		jobs->printFinishedJobs();
+	}
+}
+
+JobsTopCommand::JobsTopCommand(const char* cmd_line, JobsList* jobs, JobMonitor* monitor) :
+        BuiltInCommand(cmd_line), jobs(jobs), monitor(monitor) {}
+
+void JobsTopCommand::execute() {
+    double delay = 1;
+    int count = 0; //until ctrl-C
+    try {
+        for (int i = 1; i < getArgCount(); i += 2) {
+            if (i + 1 == getArgCount()) {
+                throw std::invalid_argument("missing value");
+            }
+            if (strcmp(getArg(i), "-d") == 0) {
+                delay = std::stod(getArg(i + 1));
+            } else if (strcmp(getArg(i), "-n") == 0) {
+                count = std::stoi(getArg(i + 1));
+            } else {
+                throw std::invalid_argument(getArg(i));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "smash error: jtop: invalid arguments" << std::endl;
+        return;
+    }
+    if (delay <= 0 || count < 0) {
+        std::cerr << "smash error: jtop: invalid arguments" << std::endl;
+        return;
+    }
+    bool terminal = isatty(1);
+    for (int i = 0; count == 0 || i < count; ++i) {
+        if (i > 0 && !EventLoop::getInstance().pause((int)(delay * 1000))) {
+            return;
+        }
+        if (terminal) {
+            std::cout << "\033[H\033[2J"; //redraw in place
+        } else if (i > 0) {
+            std::cout << "\n";
+        }
+        jobs->printJobsList(monitor);
+    }
 }
 
 KillCommand::KillCommand(const char* cmd_line, JobsList* jobs) : 
@@ -226,6 +362,11 @@ void KillCommand::execute() {
         std::cerr << "smash error: kill: invalid arguments" << std::endl;
         return;
     }*/
+	if (j->isQueued()) { //never started, there is nothing to signal
+		jobs->cancelQueuedJob(jobId);
+		std::cout << "smash: queued job " << jobId << " was cancelled" << std::endl;
+		return;
+	}
 	pid_t pid = j->getPid();
 	if (kill((-1)*pid, signum) == -1) {
 		perror("smash error: kill failed");
@@ -265,20 +406,26 @@ void ForegroundCommand::execute() {
 		return;
 		}
 	}
+	if (j->isQueued()) { //skips the queue and runs in the foreground
+		std::string commandLine = _rtrim(j->getCommandLine());
+		jobs->cancelQueuedJob(jobId);
+		commandLine = _rtrim(commandLine.substr(0, commandLine.length() - 1)); //queued lines always end with &
+		std::cout << commandLine << std::endl;
+		SmallShell::getInstance().executeCommand(commandLine.c_str());
+		return;
+	}
 	pid_t pid = j->getPid();
 	std::cout << j->getCommandLine() << " : " << pid << std::endl;	
 	if (kill((-1)*pid, SIGCONT) == -1) {
 		perror("smash error: kill failed");
 		return;
 	}
-	j->resume();
+	jobs->resumeJob(j);
     jobs->setFgCommand(pid, j->getCommandLine().c_str());
-    int status = 0;
-	if (waitpid(pid, &status, WUNTRACED) == -1) {
-        perror("smash error: waitpid failed");
-        return;
-    }
-	if (WIFEXITED(status)) { jobs->removeJob(pid); }
+	if (jobs->waitForeground(pid)) {
+		jobs->removeJob(pid);
+		SmallShell::getInstance().getTimeoutsPtr()->cancel(pid);
+	}
 }
 
 BackgroundCommand::BackgroundCommand(const char* cmd_line, JobsList* jobs) : 
@@ -314,6 +461,11 @@ void BackgroundCommand::execute() {
 		std::cerr << "smash error: bg: job-id " << jobId << " does not exist" << std::endl;
 		return;
 		}
+		if (j->isQueued()) { //skips the queue
+			std::cout << j->getCommandLine() << std::endl;
+			SmallShell::getInstance().startQueuedJob(jobId);
+			return;
+		}
 		if (!j->isStopped()) {
 			std::cerr << "smash error: bg: job-id " << jobId << " is already running in the background" << std::endl;
 			return;
@@ -325,11 +477,30 @@ void BackgroundCommand::execute() {
 		perror("smash error: kill failed");
 		return;
 	}
-	j->resume();
+	jobs->resumeJob(j);
+}
+
+HashCommand::HashCommand(const char* cmd_line, CommandHash* commandHash) :
+                BuiltInCommand(cmd_line), commandHash(commandHash) {}
+
+void HashCommand::execute() {
+    if (getArgCount() == 1) {
+        commandHash->printTable();
+        return;
+    }
+    if (getArgCount() == 2 && strcmp(getArg(1), "-r") == 0) {
+        commandHash->clear();
+        return;
+    }
+    for (int i = 1; i < getArgCount(); ++i) { // hash name... - resolve and remember
+        if (commandHash->lookup(getArg(i)).empty()) {
+            std::cerr << "smash error: hash: " << getArg(i) << ": not found" << std::endl;
+        }
+    }
 }
 
 QuitCommand::QuitCommand(const char* cmd_line, JobsList* jobs) : 
-				BuiltInCommand(cmd_line), jobs(jobs) {}
+				BuiltInCommand(cmd_line), jobs(jobs), exitStatus(SmallShell::getInstance().getLastStatus()) {}
 				
 void QuitCommand::execute() {
     for (int i = 1; getArg(i) != nullptr; ++i) {
@@ -338,304 +509,2691 @@ void QuitCommand::execute() {
             break;
         }
     }
-    exit(0);
+    SmallShell::getInstance().flushOutput();
+    exit(exitStatus); //like the end of a script: the status of the command before
 }
 
 CopyCommand::CopyCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
 
-void CopyCommand::execute() {
-    if (getArgCount() != 3) {
-        std::cerr << "smash error: cp: invalid arguments" << std::endl;
-        exit(0);
+// errno values meaning "this kernel/filesystem pair can't do it", not a real I/O error
+static bool _isUnsupportedCopy(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == ENOTTY;
+}
+
+// reflinks and copy_file_range(2) write at an offset and refuse (EBADF) an O_APPEND target, ">>"
+static bool _isAppendOnly(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags != -1 && (flags & O_APPEND);
+}
+
+const char* CopyCommand::strategyName(Strategy strategy) {
+    switch (strategy) {
+        case REFLINK: return "reflink";
+        case COPY_FILE_RANGE: return "copy_file_range";
+        case SENDFILE: return "sendfile";
+        default: return "read/write";
     }
-    int oldFileFd = -1;
-    int newFileFd = -1;
-    oldFileFd = open(getArg(1), O_RDONLY, 0666);
-    if(oldFileFd == -1) {
-        perror("smash error: open failed");
-        exit(0);
+}
+
+int CopyCommand::copyReflink(int srcFd, int dstFd) {
+    if (ioctl(dstFd, FICLONE, srcFd) == 0) {
+        return 1;
     }
-    char* resolvedSrcPath = realpath(getArg(1), nullptr);
-    if (resolvedSrcPath == nullptr) {
-        perror("smash error: realpath failed");
-        exit(0);
+    if (_isUnsupportedCopy(errno)) {
+        return 0;
     }
-    char* resolvedDstPath = realpath(getArg(2), nullptr);
-    if (resolvedDstPath == nullptr && errno != ENOENT) {
-        perror("smash error: realpath failed");
-        exit(0);
+    perror("smash error: ioctl failed");
+    return -1;
+}
+
+int CopyCommand::copyFileRange(int srcFd, int dstFd, off_t* copied) {
+    while (true) {
+        ssize_t n = copy_file_range(srcFd, nullptr, dstFd, nullptr, COPY_BUFFER_SIZE * 64, 0);
+        if (n == 0) {
+            return 1;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (*copied == 0 && _isUnsupportedCopy(errno)) {
+                return 0;
+            }
+            perror("smash error: copy_file_range failed");
+            return -1;
+        }
+        *copied += n;
     }
-    if (resolvedDstPath != nullptr && strcmp(resolvedSrcPath,resolvedDstPath) == 0) {
-        std::cout << "smash: " << getArg(1) << " was copied to " << getArg(2) << endl;
-        exit(0);
+}
+
+int CopyCommand::copySendfile(int srcFd, int dstFd, off_t* copied) {
+    while (true) {
+        ssize_t n = sendfile(dstFd, srcFd, nullptr, COPY_BUFFER_SIZE * 64);
+        if (n == 0) {
+            return 1;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (*copied == 0 && _isUnsupportedCopy(errno)) {
+                return 0;
+            }
+            perror("smash error: sendfile failed");
+            return -1;
+        }
+        *copied += n;
     }
-    free(resolvedSrcPath);
-    free(resolvedDstPath);
-    newFileFd = open(getArg(2), O_WRONLY|O_CREAT|O_TRUNC, 0666);
-    if(newFileFd == -1) {
-        perror("smash error: open failed");
-        exit(0);
+}
+
+int CopyCommand::copySplice(int srcFd, int dstFd, off_t* copied) {
+    while (true) {
+        ssize_t n = splice(srcFd, nullptr, dstFd, nullptr, COPY_BUFFER_SIZE, SPLICE_F_MOVE);
+        if (n == 0) {
+            return 1;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (*copied == 0 && _isUnsupportedCopy(errno)) {
+                return 0;
+            }
+            perror("smash error: splice failed");
+            return -1;
+        }
+        *copied += n;
+    }
+}
+
+int CopyCommand::copyReadWrite(int srcFd, int dstFd, off_t* copied) {
+    char* buf = (char*)malloc(COPY_BUFFER_SIZE);
+    if (buf == nullptr) {
+        perror("smash error: malloc failed");
+        return -1;
     }
-    char* buf[BUFFER_SIZE];
-    int bytesToCopy = -1;
-    while (bytesToCopy != 0) { //EOF reached
-        bytesToCopy = read(oldFileFd, buf, BUFFER_SIZE);
+    int result = 1;
+    while (result == 1) {
+        ssize_t bytesToCopy = read(srcFd, buf, COPY_BUFFER_SIZE);
+        if (bytesToCopy == 0) { //EOF reached
+            break;
+        }
         if (bytesToCopy == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
             perror("smash error: read failed");
-            exit(0);
+            result = -1;
+            break;
         }
-        int bytesCopied = 0;
+        ssize_t bytesCopied = 0;
         while (bytesToCopy != bytesCopied) {
-            int val = write(newFileFd, buf+bytesCopied, bytesToCopy-bytesCopied);
+            ssize_t val = write(dstFd, buf+bytesCopied, bytesToCopy-bytesCopied);
             if (val == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
                 perror("smash error: write failed");
-                exit(0);
+                result = -1;
+                break;
             }
             bytesCopied += val;
         }
+        *copied += bytesCopied;
     }
-    std::cout << "smash: " << getArg(1) << " was copied to " << getArg(2) << endl;
-    if (close(oldFileFd) == -1) {
-        perror("smash error: close failed");
-        exit(0);
-    }
-    if (close(newFileFd) == -1) {
-        perror("smash error: close failed");
-        exit(0);
-    }
-    exit(0);
+    free(buf);
+    return result;
 }
 
-ExternalCommand::ExternalCommand(const char* cmd_line) :
-        Command(cmd_line) {}
-
-RedirectionCommand::RedirectionCommand(const char *cmd_line) :
-        Command(cmd_line), append(true), filename(), stdout_fd(-1) {
-    char cmd_c[COMMAND_ARGS_MAX_LENGTH];
-    strcpy(cmd_c, cmd_line);
-    _removeBackgroundSign(cmd_c);
-    std::string cmd_s = _trim(string(cmd_c))+" ";
-    size_t index = cmd_s.find_first_of('>');
-    if (cmd_s.at(index + 1) == '>') { //>> command
-        index++;
-    } else { //> command
-        append = false;
+// copies [begin, end) with explicit offsets so workers never share a file position;
+// result: 1 when done, 0 if the source ended before end, -1 on error
+void CopyCommand::copyRange(int srcFd, int dstFd, off_t begin, off_t end, Strategy* used, int* result) {
+    off_t inOffset = begin;
+    off_t outOffset = begin;
+    char* buf = nullptr;
+    *used = COPY_FILE_RANGE;
+    *result = 1;
+    while (inOffset < end) {
+        size_t len = std::min((off_t)COPY_BUFFER_SIZE * 64, end - inOffset);
+        ssize_t n = -1;
+        if (*used == COPY_FILE_RANGE) {
+            n = copy_file_range(srcFd, &inOffset, dstFd, &outOffset, len, 0);
+            if (n == -1 && inOffset == begin && _isUnsupportedCopy(errno)) {
+                *used = READ_WRITE;
+                continue;
+            }
+        } else {
+            if (buf == nullptr && (buf = (char*)malloc(COPY_BUFFER_SIZE)) == nullptr) {
+                perror("smash error: malloc failed");
+                *result = -1;
+                break;
+            }
+            n = pread(srcFd, buf, std::min(len, (size_t)COPY_BUFFER_SIZE), inOffset);
+            for (ssize_t written = 0; n > 0 && written < n; ) {
+                ssize_t val = pwrite(dstFd, buf + written, n - written, outOffset + written);
+                if (val == -1 && errno != EINTR) {
+                    perror("smash error: pwrite failed");
+                    *result = -1;
+                    break;
+                }
+                written += (val == -1) ? 0 : val;
+            }
+            if (*result == -1) {
+                break;
+            }
+            if (n > 0) {
+                inOffset += n;
+                outOffset += n;
+            }
+        }
+        if (n == 0) { // source shrank under us, the rest of the range would stay zeros
+            *result = 0;
+            break;
+        }
+        if (n == -1 && errno != EINTR) {
+            perror(*used == COPY_FILE_RANGE ? "smash error: copy_file_range failed" : "smash error: pread failed");
+            *result = -1;
+            break;
+        }
     }
-    filename = _trim(std::string(cmd_s.substr(index + 1)));
+    free(buf);
 }
 
-bool RedirectionCommand::prepare() {
-    stdout_fd = dup(1);
-    if (stdout_fd == -1) {
-        perror("smash error: dup failed");
-        return false;
+int CopyCommand::copyParallel(int srcFd, int dstFd, off_t size, int workers, Strategy* used, off_t* copied) {
+    if (ftruncate(dstFd, size) == -1) { // size the destination once so ranges can land in any order
+        perror("smash error: ftruncate failed");
+        return -1;
     }
-    if ((close(1)) == -1) {
-        perror("smash error: close failed");
-        return false;
+    // whole 1 MiB units per worker keep ranges block aligned
+    off_t chunk = ((size / workers) + COPY_BUFFER_SIZE - 1) / COPY_BUFFER_SIZE * COPY_BUFFER_SIZE;
+    std::vector<std::thread> threads;
+    std::vector<Strategy> usedBy(workers, COPY_FILE_RANGE);
+    std::vector<int> results(workers, 0);
+    for (int i = 0; i < workers; ++i) {
+        off_t begin = std::min(size, i * chunk);
+        off_t end = (i == workers - 1) ? size : std::min(size, begin + chunk);
+        threads.push_back(std::thread(copyRange, srcFd, dstFd, begin, end, &usedBy[i], &results[i]));
     }
-    if (append) {
-        if(open(filename.c_str(), O_WRONLY|O_CREAT|O_APPEND, 0666) == -1) {
-            perror("smash error: open failed");
-            return false;
+    int result = 1;
+    bool shrank = false;
+    *used = COPY_FILE_RANGE;
+    for (int i = 0; i < workers; ++i) {
+        threads[i].join();
+        if (results[i] != 1) {
+            result = -1;
         }
-    } else {
-        if(open(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666) == -1) {
-            perror("smash error: open failed");
-            return false;
+        shrank |= (results[i] == 0);
+        if (usedBy[i] == READ_WRITE) {
+            *used = READ_WRITE;
         }
     }
-    return true;
-}
-
-void RedirectionCommand::cleanup() {
-    if ((close(1)) == -1) {
-        perror("smash error: close failed");
+    if (shrank) {
+        std::cerr << "smash error: cp: source file shrank while copying" << std::endl;
     }
-    if (dup2(stdout_fd,1) == -1) {
-        perror("smash error: dup2 failed");
-        return;
+    if (result == 1) {
+        *copied = size;
     }
+    return result;
 }
 
-PipeCommand::PipeCommand(const char *cmd_line) : Command(cmd_line), outputToStderr(true), lCommandLine(), rCommandLine() {
-    char cmd_c[COMMAND_ARGS_MAX_LENGTH];
-    strcpy(cmd_c, cmd_line);
-    _removeBackgroundSign(cmd_c);
-    std::string cmd_s = _trim(string(cmd_c))+" ";
-    size_t index = cmd_s.find_first_of('|');
-    lCommandLine = _trim(std::string(cmd_s.substr(0, index)));
-    if (cmd_s.at(index + 1) == '&') { // |& command
-        index++;
-    } else { // | command
-        outputToStderr = false;
+// fastest first: share extents, copy inside the kernel (possibly server-side), then through user space
+bool CopyCommand::copyData(int srcFd, int dstFd, int* workers, Strategy* used, off_t* copied) {
+    struct stat st;
+    if (fstat(srcFd, &st) == -1) {
+        perror("smash error: fstat failed");
+        return false;
     }
-    rCommandLine = _trim(std::string(cmd_s.substr(index + 1)));
-}
-
-void PipeCommand::execute() {
-    int fd[2];
-    pipe(fd);
-    SmallShell& smash = SmallShell::getInstance();
-    Command* lCommand = smash.CreateCommand(lCommandLine.c_str());
-    pid_t pid = fork();
-    if (pid == -1) {
-        perror("smash error: fork failed");
-        return;
+    *copied = 0;
+    // /proc-like files report size 0 and can't be offloaded; pipes and devices only stream
+    bool offload = S_ISREG(st.st_mode) && st.st_size > 0;
+    if (!offload) {
+        *workers = 1;
+    } else if (*workers == 0) {
+        int cpus = (int)std::thread::hardware_concurrency();
+        *workers = (st.st_size >= PARALLEL_COPY_THRESHOLD && cpus > 1) ?
+                   std::min(cpus, PARALLEL_COPY_MAX_WORKERS) : 1;
     }
-    if (pid == 0) { //left child
-        /*if (setpgrp() == -1) {
-            perror("smash error: setpgrp failed");
-            exit(0);
-        }*/
-        int output_fd = outputToStderr ? 2 : 1 ;
-        if (dup2(fd[1],output_fd) == -1) {
-            perror("smash error: dup2 failed");
-            exit(0);
-        }
-        if (close(fd[0]) == -1) {
-            perror("smash error: close failed");
-            exit(0);
+    int result = 0;
+    if (offload && _isAppendOnly(dstFd)) {
+        *workers = 1;
+        *used = SENDFILE;
+        result = copySendfile(srcFd, dstFd, copied);
+    } else if (offload) {
+        *used = REFLINK;
+        result = copyReflink(srcFd, dstFd);
+        if (result == 1) {
+            *workers = 1;
+            *copied = st.st_size;
+            return true;
         }
-        if (close(fd[1]) == -1) {
-            perror("smash error: close failed");
-            exit(0);
+        if (result == 0 && *workers > 1) {
+            result = copyParallel(srcFd, dstFd, st.st_size, *workers, used, copied);
+            return result == 1;
         }
-        lCommand->execute();
-        exit(0);
-    } else { //father
-        Command* rCommand = smash.CreateCommand(rCommandLine.c_str());
-        pid =  fork();
-        if (pid == -1) {
-            perror("smash error: fork failed");
-            return;
+        if (result == 0) {
+            *used = COPY_FILE_RANGE;
+            result = copyFileRange(srcFd, dstFd, copied);
         }
-        if (pid == 0) { //right child
-            /*if (setpgrp() == -1) {
-                perror("smash error: setpgrp failed");
-                exit(0);
-            }*/
-            if (dup2(fd[0],0) == -1) {
-                perror("smash error: dup2 failed");
-                exit(0);
-            }
-            if (close(fd[0]) == -1) {
-                perror("smash error: close failed");
-                exit(0);
-            }
-            if (close(fd[1]) == -1) {
-                perror("smash error: close failed");
-                exit(0);
-            }
-            rCommand->execute();
-            exit(0);
-        } else { //father
-            if (close(fd[0]) == -1) {
-                perror("smash error: close failed");
-            }
-            if (close(fd[1]) == -1) {
-                perror("smash error: close failed");
-            }
-            if (wait(nullptr) == -1) {
-                perror("smash error: wait failed");
-            }
-            if (wait(nullptr) == -1) {
-                perror("smash error: wait failed");
-            }
-            exit(0);
+        if (result == 0) {
+            *used = SENDFILE;
+            result = copySendfile(srcFd, dstFd, copied);
         }
     }
+    if (result == 0) {
+        *used = READ_WRITE;
+        result = copyReadWrite(srcFd, dstFd, copied);
+    }
+    return result == 1;
 }
 
-
-void ExternalCommand::execute() {
-    char arg0[10];
-    char arg1[3];
-    char arg2[COMMAND_ARGS_MAX_LENGTH];
-    strcpy(arg0, "/bin/bash");
-    strcpy(arg1, "-c");
-    strcpy(arg2, getCommandLine().c_str());
-    _removeBackgroundSign(arg2);
-    char* bashArgs[4] = {arg0, arg1, arg2, nullptr};
-    if (execv("/bin/bash", bashArgs) == -1) {
-        perror("smash error: execv failed");
-        exit(0);
+CatCommand::CatCommand(const char* cmd_line) : BuiltInCommand(cmd_line), inProcess(getArgCount() > 1) {
+    for (int i = 1; i < getArgCount() && inProcess; ++i) {
+        struct stat st;
+        inProcess = strcmp(getArg(i), "-") != 0 && (stat(getArg(i), &st) == -1 || S_ISREG(st.st_mode));
     }
 }
 
+bool CatCommand::isSupported() {
+    if (_isBashRequired(getBody(), getArgs())) {
+        return false;
+    }
+    for (int i = 1; i < getArgCount(); ++i) {
+        if (getArg(i)[0] == '-' && getArg(i)[1] != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
 
-TimeoutCommand::TimeoutCommand(const char *cmd_line) : Command(cmd_line) {}
-
-void TimeoutCommand::execute() {
-    if (getArgCount() < 3) {
-        std::cerr << "smash error: timeout: invalid arguments" << std::endl;
-        return;
+// a pipe on either side is spliced, file to file stays in the filesystem, and anything else
+// (a terminal) gets large reads and writes
+bool CatCommand::catData(int srcFd, int dstFd) {
+    struct stat in, out;
+    if (fstat(srcFd, &in) == -1 || fstat(dstFd, &out) == -1) {
+        perror("smash error: fstat failed");
+        return false;
     }
-    int timeout = 0;
-    try {
-        timeout = std::stoi(getArg(1));
-    } catch (const std::invalid_argument& ia) {
-        std::cerr << "smash error: timeout: invalid arguments" << std::endl;
-        return;
+    if (S_ISREG(in.st_mode) && S_ISREG(out.st_mode) && in.st_dev == out.st_dev && in.st_ino == out.st_ino &&
+            in.st_size > 0) { //would read what it writes until the disk is full
+        std::cerr << "smash error: cat: input file is output file" << std::endl;
+        return false;
     }
-    if (timeout <= 0) {
-        std::cerr << "smash error: timeout: invalid arguments" << std::endl;
-        return;
+    off_t copied = 0;
+    int result = 0;
+    if (S_ISFIFO(in.st_mode) || S_ISFIFO(out.st_mode)) {
+        result = CopyCommand::copySplice(srcFd, dstFd, &copied);
     }
-    SmallShell& smash = SmallShell::getInstance();
-    smash.setTimeoutDuration(timeout);
-    std::string commandLine = getCommandLine();
-    smash.setTimeoutOriginalCommandLine(commandLine); //with "timeout"
-    size_t index = commandLine.find_first_of(WHITESPACE);
-    commandLine = _trim(commandLine.substr(index)); //remove 1st arg ("timeout")
-    index = commandLine.find_first_of(WHITESPACE);
-    commandLine = _trim(commandLine.substr(index)); //remove 2nd arg ("<timeout duration>")
-    smash.executeCommand(commandLine.c_str());
+    if (result == 0 && S_ISREG(in.st_mode) && S_ISREG(out.st_mode) && !_isAppendOnly(dstFd)) {
+        result = CopyCommand::copyFileRange(srcFd, dstFd, &copied);
+    }
+    if (result == 0 && S_ISREG(in.st_mode) && !S_ISCHR(out.st_mode)) {
+        result = CopyCommand::copySendfile(srcFd, dstFd, &copied);
+    }
+    if (result == 0) {
+        result = CopyCommand::copyReadWrite(srcFd, dstFd, &copied);
+    }
+    return result == 1;
 }
 
+void CatCommand::execute() {
+    SmallShell& smash = SmallShell::getInstance();
+    smash.flushOutput();
+    bool failed = false;
+    for (int i = 1; i < getArgCount() || i == 1; ++i) { //no operands reads stdin
+        const char* path = (getArgCount() == 1) ? "-" : getArg(i);
+        int fd = (strcmp(path, "-") == 0) ? 0 : open(path, O_RDONLY|O_CLOEXEC);
+        if (fd == -1) {
+            perror("smash error: open failed");
+            failed = true;
+            continue;
+        }
+        if (!catData(fd, 1)) {
+            failed = true;
+        }
+        if (fd != 0 && close(fd) == -1) {
+            perror("smash error: close failed");
+        }
+    }
+    if (failed) {
+        smash.setLastStatus(1);
+    }
+}
 
-void JobsList::printJobsList() {
-    removeFinishedJobs();
-    for (const JobEntry& j : jobsList) {
-        std::cout << "[" << j.getJobId() << "] " <<
-                  j.getCommandLine() << " : " <<
-                  j.getPid() << " " <<
-                  j.getSecondsElapsed() << " secs";
-        if (j.isStopped()) {
-            std::cout << " (stopped)";
+// words as coreutils counts them in the C locale: a printable byte after whitespace (\t \n \v \f \r,
+// space) starts one, and any other byte (control, NUL, >= 0x80) neither starts nor ends a word
+static unsigned long long _wcWords(const unsigned char* data, size_t length, bool* inWord) {
+    unsigned long long words = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] == ' ' || (unsigned char)(data[i] - 9) < 5) {
+            *inWord = false;
+        } else if ((unsigned char)(data[i] - 0x21) < 0x5e) {
+            words += !*inWord;
+            *inWord = true;
         }
-        std::cout << endl;
     }
+    return words;
 }
 
-void JobsList::killAllJobs() { // (print format in pdf p.9)
-    std::cout << "smash: sending SIGKILL signal to " << jobsList.size() << " jobs:" << endl;
-    for (const JobEntry &j : jobsList) {
-        std::cout << j.getPid() << ": " << j.getCommandLine() << endl;
+static void _wcScalar(const unsigned char* data, size_t length, WcCommand::Counts* counts) {
+    const unsigned char* end = data + length;
+    for (const unsigned char* p = data; (p = (const unsigned char*)memchr(p, '\n', end - p)) != nullptr; ++p) {
+        counts->lines++;
     }
-    for (const JobEntry &j : jobsList) {
-        if (kill((-1)*j.getPid(), SIGKILL) == -1) {
-            perror("smash error: kill failed");
-            return;
+    counts->words += _wcWords(data, length, &counts->inWord);
+    counts->bytes += length;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// per block: bit masks of newlines, whitespace and printable bytes. When those two cover the whole
+// block, word starts are the printable bits whose previous bit (the carried state, for bit 0) is
+// whitespace; blocks holding other bytes go through _wcWords
+__attribute__((target("sse2")))
+static void _wcSse2(const unsigned char* data, size_t length, WcCommand::Counts* counts) {
+    const __m128i newline = _mm_set1_epi8('\n'), blank = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8(9), four = _mm_set1_epi8(4);
+    const __m128i bang = _mm_set1_epi8(0x21), lastPrintable = _mm_set1_epi8(0x5d);
+    unsigned long long lines = 0, words = 0;
+    bool inWord = counts->inWord;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i control = _mm_sub_epi8(v, tab); //\t..\r become 0..4
+        __m128i printable = _mm_sub_epi8(v, bang); //'!'..'~' become 0..0x5d
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, blank), _mm_cmpeq_epi8(_mm_min_epu8(control, four), control));
+        unsigned int spaceMask = (unsigned int)_mm_movemask_epi8(space);
+        unsigned int wordMask = (unsigned int)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_min_epu8(printable, lastPrintable), printable));
+        lines += __builtin_popcount((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)));
+        if ((spaceMask | wordMask) != 0xFFFF) {
+            words += _wcWords(data + i, 16, &inWord);
+            continue;
         }
+        words += __builtin_popcount(wordMask & ((spaceMask << 1) | !inWord));
+        inWord = (wordMask >> 15) != 0;
     }
-    jobsList.clear();
+    counts->lines += lines;
+    counts->words += words;
+    counts->bytes += i;
+    counts->inWord = inWord;
+    _wcScalar(data + i, length - i, counts);
 }
 
-void JobsList::removeFinishedJobs() {
-    std::list<int> toRemove;
-    for (JobEntry &j : jobsList) {
-        pid_t pid = (waitpid(j.getPid(), nullptr, WNOHANG));
-        if (pid == -1) {
-            perror("smash error: waitpid failed");
+__attribute__((target("avx2,popcnt")))
+static void _wcAvx2(const unsigned char* data, size_t length, WcCommand::Counts* counts) {
+    const __m256i newline = _mm256_set1_epi8('\n'), blank = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8(9), four = _mm256_set1_epi8(4);
+    const __m256i bang = _mm256_set1_epi8(0x21), lastPrintable = _mm256_set1_epi8(0x5d);
+    unsigned long long lines = 0, words = 0;
+    bool inWord = counts->inWord;
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) { //two registers, so each mask fills a 64-bit word
+        unsigned long long newlineMask = 0, spaceMask = 0, wordMask = 0;
+        for (int half = 0; half < 2; ++half) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(data + i + 32 * half));
+            __m256i control = _mm256_sub_epi8(v, tab);
+            __m256i printable = _mm256_sub_epi8(v, bang);
+            __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, blank),
+                                            _mm256_cmpeq_epi8(_mm256_min_epu8(control, four), control));
+            __m256i word = _mm256_cmpeq_epi8(_mm256_min_epu8(printable, lastPrintable), printable);
+            newlineMask |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)) <<
+                           (32 * half);
+            spaceMask |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(space) << (32 * half);
+            wordMask |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(word) << (32 * half);
         }
-        if (pid > 0) {
-            toRemove.push_back(pid);
+        lines += _mm_popcnt_u64(newlineMask);
+        if (~(spaceMask | wordMask) != 0) {
+            words += _wcWords(data + i, 64, &inWord);
+            continue;
         }
+        words += _mm_popcnt_u64(wordMask & ((spaceMask << 1) | !inWord));
+        inWord = (wordMask >> 63) != 0;
     }
-    for (int i : toRemove) {
-        removeJob(i);
-    }
+    counts->lines += lines;
+    counts->words += words;
+    counts->bytes += i;
+    counts->inWord = inWord;
+    _wcSse2(data + i, length - i, counts);
+}
+#endif
+
+enum SimdLevel { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 };
+
+// the widest kernel this CPU runs (CPUID), or a narrower one named by the environment variable
+static SimdLevel _simdLevel(const char* variable) {
+    const char* wanted = getenv(variable);
+    SimdLevel level = SIMD_SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        level = SIMD_AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        level = SIMD_SSE2;
+    }
+#endif
+    if (wanted != nullptr && strcmp(wanted, "scalar") == 0) {
+        level = SIMD_SCALAR;
+    } else if (wanted != nullptr && strcmp(wanted, "sse2") == 0) {
+        level = std::min(level, SIMD_SSE2);
+    }
+    return level;
+}
+
+typedef void (*WcKernel)(const unsigned char*, size_t, WcCommand::Counts*);
+
+static WcKernel _wcKernel() { //chosen once, see $SMASH_WC_KERNEL
+    static WcKernel kernel = nullptr;
+    if (kernel == nullptr) {
+        SimdLevel level = _simdLevel("SMASH_WC_KERNEL");
+        kernel = _wcScalar;
+#if defined(__x86_64__) || defined(__i386__)
+        kernel = (level == SIMD_AVX2) ? _wcAvx2 : (level == SIMD_SSE2) ? _wcSse2 : _wcScalar;
+#endif
+        (void)level;
+    }
+    return kernel;
+}
+
+void WcCommand::count(const char* data, size_t length, Counts* counts) {
+    _wcKernel()((const unsigned char*)data, length, counts);
+}
+
+WcCommand::WcCommand(const char* cmd_line) : BuiltInCommand(cmd_line), showLines(false), showWords(false),
+        showBytes(false), supported(!_isBashRequired(getBody(), getArgs())), inProcess(true) {
+    int files = 0;
+    for (int i = 1; i < getArgCount() && supported; ++i) {
+        const char* arg = getArg(i);
+        if (arg[0] == '-' && arg[1] != '\0') {
+            for (const char* c = arg + 1; *c != '\0'; ++c) {
+                showLines |= (*c == 'l');
+                showWords |= (*c == 'w');
+                showBytes |= (*c == 'c');
+                supported &= (*c == 'l' || *c == 'w' || *c == 'c');
+            }
+            continue;
+        }
+        struct stat st;
+        files++;
+        inProcess &= strcmp(arg, "-") != 0 && (stat(arg, &st) == -1 || S_ISREG(st.st_mode));
+    }
+    inProcess &= files > 0;
+    if (!showLines && !showWords && !showBytes) {
+        showLines = showWords = showBytes = true;
+    }
+}
+
+// regular files are mapped and counted where they lie; a byte count alone comes from their size
+bool WcCommand::countFd(int fd, Counts* counts, bool bytesOnly) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("smash error: fstat failed");
+        return false;
+    }
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        off_t offset = std::min(std::max(lseek(fd, 0, SEEK_CUR), (off_t)0), st.st_size); //stdin may be part read
+        if (bytesOnly) {
+            counts->bytes += st.st_size - offset;
+            return true;
+        }
+        void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+            count((const char*)mapping + offset, st.st_size - offset, counts);
+            munmap(mapping, st.st_size);
+            return true;
+        }
+    }
+    std::vector<char> buffer(COPY_BUFFER_SIZE); //pipes, devices and size-0 /proc files
+    while (true) {
+        ssize_t n = read(fd, buffer.data(), buffer.size());
+        if (n == 0) {
+            return true;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("smash error: read failed");
+            return false;
+        }
+        count(buffer.data(), n, counts);
+    }
+}
+
+// coreutils' layout: one column width for every line, wide enough for the total of the regular
+// files' sizes, at least 7 if anything else is read, and no padding for a single count of one input
+void WcCommand::execute() {
+    SmallShell& smash = SmallShell::getInstance();
+    std::vector<const char*> paths;
+    for (int i = 1; i < getArgCount(); ++i) {
+        if (getArg(i)[0] != '-' || getArg(i)[1] == '\0') {
+            paths.push_back(getArg(i));
+        }
+    }
+    bool named = !paths.empty();
+    if (!named) {
+        paths.push_back("-");
+    }
+    std::vector<Counts> counts(paths.size());
+    std::vector<bool> counted(paths.size(), false);
+    unsigned long long regularBytes = 0;
+    int minimumWidth = 1;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        int fd = (strcmp(paths[i], "-") == 0) ? 0 : open(paths[i], O_RDONLY|O_CLOEXEC);
+        if (fd == -1) {
+            perror("smash error: open failed");
+            continue;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            regularBytes += st.st_size;
+        } else {
+            minimumWidth = 7;
+        }
+        counted[i] = countFd(fd, &counts[i], showBytes && !showLines && !showWords);
+        if (fd != 0 && close(fd) == -1) {
+            perror("smash error: close failed");
+        }
+    }
+    int width = 1;
+    for (unsigned long long total = regularBytes; total >= 10; total /= 10) {
+        width++;
+    }
+    width = std::max(width, minimumWidth);
+    if (paths.size() == 1 && showLines + showWords + showBytes == 1) {
+        width = 1;
+    }
+    std::ostringstream out;
+    Counts total;
+    bool failed = false;
+    for (size_t i = 0; i <= paths.size(); ++i) {
+        bool isTotal = (i == paths.size());
+        if (isTotal && paths.size() < 2) {
+            break;
+        }
+        if (!isTotal && !counted[i]) {
+            failed = true;
+            continue;
+        }
+        const Counts& c = isTotal ? total : counts[i];
+        const char* separator = "";
+        if (showLines) {
+            out << separator << std::setw(width) << c.lines;
+            separator = " ";
+        }
+        if (showWords) {
+            out << separator << std::setw(width) << c.words;
+            separator = " ";
+        }
+        if (showBytes) {
+            out << separator << std::setw(width) << c.bytes;
+        }
+        if (isTotal) {
+            out << " total";
+        } else if (named) {
+            out << " " << paths[i];
+        }
+        out << "\n";
+        total.lines += c.lines;
+        total.words += c.words;
+        total.bytes += c.bytes;
+    }
+    std::cout << out.str();
+    if (failed) {
+        smash.setLastStatus(1);
+    }
+}
+
+static double _monotonicSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void CopyCommand::execute() { //always forked: the exit status is the command's
+    bool verbose = SmallShell::getInstance().isTraceEnabled();
+    int workers = 0;
+    int firstPath = 1;
+    while (firstPath < getArgCount() - 2 && getArg(firstPath)[0] == '-') { // cp [-v] [-j N] src dst
+        if (strcmp(getArg(firstPath), "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(getArg(firstPath), "-j") == 0 && firstPath + 1 < getArgCount() - 2) {
+            try {
+                workers = std::stoi(getArg(++firstPath));
+            } catch (const std::exception& e) {
+                workers = -1;
+            }
+            if (workers < 1) {
+                std::cerr << "smash error: cp: invalid arguments" << std::endl;
+                exit(1);
+            }
+        } else {
+            break;
+        }
+        firstPath++;
+    }
+    if (getArgCount() != firstPath + 2) {
+        std::cerr << "smash error: cp: invalid arguments" << std::endl;
+        exit(1);
+    }
+    const char* src = getArg(firstPath);
+    const char* dst = getArg(firstPath + 1);
+    int oldFileFd = -1;
+    int newFileFd = -1;
+    oldFileFd = open(src, O_RDONLY, 0666);
+    if(oldFileFd == -1) {
+        perror("smash error: open failed");
+        exit(1);
+    }
+    char* resolvedSrcPath = realpath(src, nullptr);
+    if (resolvedSrcPath == nullptr) {
+        perror("smash error: realpath failed");
+        exit(1);
+    }
+    char* resolvedDstPath = realpath(dst, nullptr);
+    if (resolvedDstPath == nullptr && errno != ENOENT) {
+        perror("smash error: realpath failed");
+        exit(1);
+    }
+    if (resolvedDstPath != nullptr && strcmp(resolvedSrcPath,resolvedDstPath) == 0) {
+        std::cout << "smash: " << src << " was copied to " << dst << endl;
+        exit(0);
+    }
+    free(resolvedSrcPath);
+    free(resolvedDstPath);
+    newFileFd = open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if(newFileFd == -1) {
+        perror("smash error: open failed");
+        exit(1);
+    }
+    double start = _monotonicSeconds();
+    Strategy used = READ_WRITE;
+    off_t copied = 0;
+    if (!copyData(oldFileFd, newFileFd, &workers, &used, &copied)) {
+        exit(1);
+    }
+    double elapsed = _monotonicSeconds() - start;
+    std::cout << "smash: " << src << " was copied to " << dst << endl;
+    if (verbose) {
+        double mibPerSec = (elapsed > 0) ? (copied / (1024.0 * 1024.0)) / elapsed : 0;
+        std::cout << "smash: cp: " << strategyName(used);
+        if (workers > 1) {
+            std::cout << " x" << workers;
+        }
+        std::cout << ", " << copied << " bytes in " <<
+                  std::fixed << std::setprecision(3) << elapsed << " secs (" <<
+                  std::setprecision(1) << mibPerSec << " MiB/s)" << endl;
+    }
+    if (close(oldFileFd) == -1) {
+        perror("smash error: close failed");
+        exit(1);
+    }
+    if (close(newFileFd) == -1) {
+        perror("smash error: close failed");
+        exit(1);
+    }
+    exit(0);
+}
+
+ExternalCommand::ExternalCommand(const char* cmd_line) :
+        Command(cmd_line), bashRequired(true) {
+    bashRequired = _isBashRequired(getBody(), getArgs());
+    SmallShell& smash = SmallShell::getInstance();
+    if (!bashRequired) {
+        execPath = smash.getCommandHashPtr()->lookup(getArg(0));
+        if (execPath.empty()) { // not found - let bash report it the way it always did
+            bashRequired = true;
+        }
+    }
+}
+
+RedirectionCommand::RedirectionCommand(const char *cmd_line) :
+        Command(cmd_line), append(true), filename(), stdout_fd(-1) {
+    std::string cmd_s = string(getBody())+" ";
+    size_t index = _findUnquoted(cmd_s, ">");
+    if (cmd_s.at(index + 1) == '>') { //>> command
+        index++;
+    } else { //> command
+        append = false;
+    }
+    filename = _trim(std::string(cmd_s.substr(index + 1)));
+    if (filename.length() >= 2 && (filename[0] == '"' || filename[0] == '\'') &&
+            filename[filename.length() - 1] == filename[0]) { //> "name with spaces"
+        filename = filename.substr(1, filename.length() - 2);
+    }
+}
+
+int RedirectionCommand::openTarget() {
+    int flags = O_WRONLY|O_CREAT|O_CLOEXEC|(append ? O_APPEND : O_TRUNC);
+    int fd = open(filename.c_str(), flags, 0666);
+    if (fd == -1) {
+        perror("smash error: open failed");
+    }
+    return fd;
+}
+
+bool RedirectionCommand::prepare() {
+    SmallShell::getInstance().flushOutput(); //what was printed so far belongs to the old stdout
+    stdout_fd = dup(1);
+    if (stdout_fd == -1) {
+        perror("smash error: dup failed");
+        return false;
+    }
+    int fd = openTarget();
+    if (fd == -1) {
+        return false;
+    }
+    if (dup2(fd, 1) == -1) {
+        perror("smash error: dup2 failed");
+        close(fd);
+        return false;
+    }
+    if (close(fd) == -1) {
+        perror("smash error: close failed");
+    }
+    return true;
+}
+
+void RedirectionCommand::cleanup() {
+    SmallShell::getInstance().flushOutput();
+    if ((close(1)) == -1) {
+        perror("smash error: close failed");
+    }
+    if (dup2(stdout_fd,1) == -1) {
+        perror("smash error: dup2 failed");
+        return;
+    }
+}
+
+PipeCommand::PipeCommand(const char *cmd_line) : Command(cmd_line), stageLines(), stderrPiped(), fanoutLines(),
+        lastStagePid(0) {
+    std::string cmd_s = getBody();
+    size_t fanout = _findUnquoted(cmd_s, "|{");
+    if (fanout != string::npos) { //consumers may carry their own redirections
+        size_t close = cmd_s.find_last_of('}');
+        std::string consumers = cmd_s.substr(fanout + 2, (close == string::npos || close < fanout) ?
+                                                          string::npos : close - fanout - 2) + ";";
+        size_t begin = 0;
+        size_t semicolon = 0;
+        while ((semicolon = _findUnquoted(consumers, ";", begin)) != string::npos) {
+            std::string consumer = _trim(consumers.substr(begin, semicolon - begin));
+            if (!consumer.empty()) {
+                fanoutLines.push_back(consumer);
+            }
+            begin = semicolon + 1;
+        }
+        cmd_s = cmd_s.substr(0, fanout);
+    }
+    cmd_s = cmd_s.substr(0, _findUnquoted(cmd_s, ">")) + " "; //redirection belongs to the last stage
+    size_t start = 0;
+    size_t index = 0;
+    while ((index = _findUnquoted(cmd_s, "|", start)) != string::npos) {
+        stageLines.push_back(_trim(cmd_s.substr(start, index - start)));
+        if (cmd_s.at(index + 1) == '&') { // |& command
+            index++;
+            stderrPiped.push_back(true);
+        } else { // | command
+            stderrPiped.push_back(false);
+        }
+        start = index + 1;
+    }
+    stageLines.push_back(_trim(cmd_s.substr(start)));
+}
+
+pid_t PipeCommand::launchStage(Command* stage, int stdinFd, int stdoutFd, int stderrFd, pid_t pgroup) {
+    SmallShell& smash = SmallShell::getInstance();
+    ExternalCommand* external = dynamic_cast<ExternalCommand*>(stage);
+    if (external && smash.isSpawnEnabled() && !smash.hasLimits()) {
+        return external->spawn(stdinFd, stdoutFd, stderrFd, pgroup);
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("smash error: fork failed");
+        return -1;
+    }
+    if (pid == 0) { //stage child
+        EventLoop::resetChildSignals();
+        if (setpgid(0, pgroup) == -1) {
+            perror("smash error: setpgid failed");
+            exit(0);
+        }
+        smash.applyLimits(0);
+        int fds[3] = {stdinFd, stdoutFd, stderrFd};
+        for (int i = 0; i < 3; ++i) {
+            if (fds[i] != -1 && dup2(fds[i], i) == -1) {
+                perror("smash error: dup2 failed");
+                exit(0);
+            }
+        }
+        // pipe ends are close-on-exec, but a builtin stage never execs - drop every one it
+        // inherited, or the stages reading them would never see EOF
+        close_range(3, ~0U, 0);
+        smash.setLastStatus(0); //the stage's exit status is what a builtin sets, not what smash had
+        stage->execute();
+        exit(smash.getLastStatus());
+    }
+    setpgid(pid, pgroup == 0 ? pid : pgroup); //also from the parent, whoever runs first wins
+    smash.applyLimits(pid);
+    return pid;
+}
+
+pid_t PipeCommand::launch(RedirectionCommand* redirection) {
+    SmallShell& smash = SmallShell::getInstance();
+    int redirectFd = -1;
+    if (redirection) {
+        redirectFd = redirection->openTarget();
+        if (redirectFd == -1) {
+            return 0;
+        }
+    }
+    pid_t pgid = 0;
+    int prevRead = -1;
+    bool failed = false;
+    for (size_t i = 0; i < stageLines.size() && !failed; ++i) {
+        int fd[2] = {-1, -1};
+        bool last = (i + 1 == stageLines.size()) && fanoutLines.empty();
+        if (!last) {
+            if (pipe2(fd, O_CLOEXEC) == -1) {
+                perror("smash error: pipe failed");
+                failed = true;
+                break;
+            }
+            if (smash.getPipeSize() > 0 && fcntl(fd[1], F_SETPIPE_SZ, smash.getPipeSize()) == -1) {
+                perror("smash error: fcntl failed");
+            }
+        }
+        bool toStderr = (i < stderrPiped.size() && stderrPiped[i]); //the fan-out is always fed by stdout
+        int stdoutFd = (!last && !toStderr) ? fd[1] : redirectFd;
+        int stderrFd = (!last && toStderr) ? fd[1] : -1;
+        Command* stage = smash.CreateCommand(stageLines[i].c_str());
+        pid_t pid = 0;
+        if (stage) {
+            pid = launchStage(stage, prevRead, stdoutFd, stderrFd, pgid);
+            delete stage;
+        }
+        if (pid == -1) {
+            failed = true;
+        } else if (pid > 0) {
+            lastStagePid = pid;
+            if (pgid == 0) {
+                pgid = pid;
+            }
+        }
+        if (prevRead != -1) {
+            close(prevRead);
+        }
+        if (fd[1] != -1) {
+            close(fd[1]);
+        }
+        prevRead = fd[0];
+    }
+    if (!failed && !fanoutLines.empty() && !launchFanout(prevRead, &pgid)) {
+        failed = true;
+    }
+    if (prevRead != -1) {
+        close(prevRead);
+    }
+    if (redirectFd != -1) {
+        close(redirectFd);
+    }
+    if (failed && pgid > 0) { //don't leave half a pipeline behind
+        kill(-pgid, SIGKILL);
+        while (waitpid(-pgid, nullptr, 0) > 0 || errno == EINTR) {}
+        return -1;
+    }
+    return failed ? -1 : pgid;
+}
+
+// The forwarder never execs, so it would hold on to smash's epoll, signalfd and timerfd and to any
+// redirect target opened for another stage - keep stdio and its own pipe ends, close the rest
+static void _closeAllBut(int producerFd, const std::vector<int>& outs, const std::vector<int>& relayRead,
+                         const std::vector<int>& relayWrite) {
+    std::vector<int> keep = {2, producerFd};
+    keep.insert(keep.end(), outs.begin(), outs.end());
+    keep.insert(keep.end(), relayRead.begin(), relayRead.end());
+    keep.insert(keep.end(), relayWrite.begin(), relayWrite.end());
+    std::sort(keep.begin(), keep.end());
+    unsigned int from = 0;
+    for (int fd : keep) {
+        if ((unsigned int)fd > from) {
+            close_range(from, fd - 1, 0);
+        }
+        from = std::max(from, (unsigned int)fd + 1);
+    }
+    close_range(from, ~0U, 0);
+}
+
+// Stops feeding the consumer at outs[level] after it exited. False (errno EPIPE) once every
+// consumer is gone, so the forwarder can give up on the producer
+static bool _fanoutDrop(std::vector<int>& outs, size_t level) {
+    close(outs[level]);
+    outs[level] = -1;
+    errno = EPIPE;
+    return std::count(outs.begin(), outs.end(), -1) < (std::ptrdiff_t)outs.size();
+}
+
+// Where the bytes meant for outs[level] go: a dropped consumer's share is spliced to /dev/null,
+// they still have to leave the pipe for the consumers after it
+static int _fanoutTarget(const std::vector<int>& outs, size_t level) {
+    static int devNull = -1;
+    if (outs[level] != -1) {
+        return outs[level];
+    }
+    if (devNull == -1) {
+        devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    }
+    return devNull;
+}
+
+// Forwards `avail` bytes queued in `in` (all of it until EOF at level 0) to outs[level..]: tee(2)
+// duplicates them into outs[level] without consuming, then splice(2) moves the same bytes into the
+// next level's relay pipe (or straight into the last consumer). The data never enters user space,
+// and every call blocks on a full consumer, so the slowest one throttles the producer.
+// A consumer that exits early (EPIPE) is dropped and the rest keep being fed; once none is left
+// this fails with EPIPE, which closes the producer's pipe like a plain "a | b" would.
+static bool _fanoutForward(int in, size_t avail, size_t level, std::vector<int>& outs,
+                           const std::vector<int>& relayRead, const std::vector<int>& relayWrite) {
+    const size_t chunk = 1 << 20;
+    while (avail > 0) {
+        size_t want = std::min(avail, chunk);
+        if (level + 1 == outs.size()) { //last consumer takes the bytes themselves
+            ssize_t n = splice(in, nullptr, _fanoutTarget(outs, level), nullptr, want, SPLICE_F_MOVE);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1 && errno == EPIPE && _fanoutDrop(outs, level)) {
+                continue;
+            }
+            if (n <= 0) {
+                return n == 0;
+            }
+            avail -= n;
+            continue;
+        }
+        ssize_t n = want; //with nobody left at this level, only a bound on what to move on
+        if (outs[level] != -1) {
+            n = tee(in, outs[level], want, 0);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1 && errno == EPIPE && _fanoutDrop(outs, level)) {
+                continue;
+            }
+            if (n <= 0) {
+                return n == 0;
+            }
+        }
+        bool lastRelay = (level + 2 == outs.size());
+        for (ssize_t left = n; left > 0; ) {
+            int next = lastRelay ? _fanoutTarget(outs, level + 1) : relayWrite[level];
+            ssize_t m = splice(in, nullptr, next, nullptr, left, SPLICE_F_MOVE);
+            if (m == -1 && errno == EINTR) {
+                continue;
+            }
+            if (m == -1 && errno == EPIPE && lastRelay && _fanoutDrop(outs, level + 1)) {
+                continue;
+            }
+            if (m == 0 && outs[level] == -1) { //producer EOF, no tee to have seen it first
+                return true;
+            }
+            if (m <= 0) {
+                return false;
+            }
+            if (!lastRelay && !_fanoutForward(relayRead[level], m, level + 1, outs, relayRead, relayWrite)) {
+                return false;
+            }
+            left -= m;
+            avail -= m;
+            if (outs[level] == -1) { //n was a bound, not what is queued - go look again
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool PipeCommand::launchFanout(int producerFd, pid_t* pgroup) {
+    SmallShell& smash = SmallShell::getInstance();
+    std::vector<int> outs;
+    bool failed = false;
+    for (const std::string& line : fanoutLines) {
+        int fd[2];
+        if (pipe2(fd, O_CLOEXEC) == -1) {
+            perror("smash error: pipe failed");
+            failed = true;
+            break;
+        }
+        if (smash.getPipeSize() > 0 && fcntl(fd[1], F_SETPIPE_SZ, smash.getPipeSize()) == -1) {
+            perror("smash error: fcntl failed");
+        }
+        int redirectFd = -1;
+        size_t redirect = _findUnquoted(line, ">");
+        if (redirect != string::npos) {
+            RedirectionCommand redirection(line.c_str());
+            redirectFd = redirection.openTarget();
+        }
+        Command* consumer = nullptr;
+        if (redirect == string::npos || redirectFd != -1) {
+            consumer = smash.CreateCommand(line.substr(0, redirect).c_str());
+        }
+        pid_t pid = consumer ? launchStage(consumer, fd[0], redirectFd, -1, *pgroup) : 0;
+        delete consumer;
+        close(fd[0]);
+        if (redirectFd != -1) {
+            close(redirectFd);
+        }
+        if (pid <= 0) {
+            close(fd[1]);
+            failed = (pid == -1);
+            if (failed) {
+                break;
+            }
+            continue;
+        }
+        if (*pgroup == 0) {
+            *pgroup = pid;
+        }
+        lastStagePid = pid;
+        outs.push_back(fd[1]);
+    }
+    std::vector<int> relayRead;
+    std::vector<int> relayWrite;
+    for (size_t i = 0; !failed && i + 2 < outs.size(); ++i) {
+        int fd[2];
+        if (pipe2(fd, O_CLOEXEC) == -1) {
+            perror("smash error: pipe failed");
+            failed = true;
+            break;
+        }
+        relayRead.push_back(fd[0]);
+        relayWrite.push_back(fd[1]);
+    }
+    if (!failed && !outs.empty()) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("smash error: fork failed");
+            failed = true;
+        } else if (pid == 0) { //fan-out child - only moves pages between pipes
+            EventLoop::resetChildSignals();
+            if (setpgid(0, *pgroup) == -1) {
+                perror("smash error: setpgid failed");
+            }
+            signal(SIGPIPE, SIG_IGN); //an exited consumer is an EPIPE to handle, not the end of all of them
+            _closeAllBut(producerFd, outs, relayRead, relayWrite);
+            bool done = _fanoutForward(producerFd, (size_t)-1, 0, outs, relayRead, relayWrite);
+            if (!done && errno != EPIPE) {
+                perror("smash error: splice failed");
+            }
+            exit(0);
+        } else {
+            setpgid(pid, *pgroup);
+        }
+    }
+    for (size_t i = 0; i < relayRead.size(); ++i) {
+        close(relayRead[i]);
+        close(relayWrite[i]);
+    }
+    for (int fd : outs) {
+        close(fd);
+    }
+    return !failed;
+}
+
+void PipeCommand::execute() { // pipeline nested in an already forked command
+    pid_t pgid = launch(nullptr);
+    if (pgid > 0) {
+        while (waitpid(-pgid, nullptr, 0) > 0 || errno == EINTR) {}
+    }
+}
+
+void ExternalCommand::execute() {
+    SmallShell& smash = SmallShell::getInstance();
+    if (!bashRequired) { // plain "prog arg..." line - exec it directly with our own argv
+        smash.noteExec(true, getCommandLine()); //nothing runs here after a successful exec
+        execv(execPath.c_str(), getArgs());
+        if (errno != ENOENT && errno != ENOEXEC) {
+            perror("smash error: execv failed");
+            exit(126);
+        }
+        // removed between lookup and exec, or a script without #! - let bash run or report it
+        smash.noteExecFallback(getCommandLine());
+    } else {
+        smash.noteExec(false, getCommandLine());
+    }
+    execBash();
+}
+
+pid_t ExternalCommand::spawn(int stdinFd, int stdoutFd, int stderrFd, pid_t pgroup) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    int fds[3] = {stdinFd, stdoutFd, stderrFd};
+    for (int i = 0; i < 3; ++i) {
+        if (fds[i] != -1) {
+            posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+        }
+    }
+    sigset_t noSignals; // smash blocks the signals it reads through signalfd, the program must not inherit that
+    sigemptyset(&noSignals);
+    posix_spawnattr_setsigmask(&attr, &noSignals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP|POSIX_SPAWN_SETSIGMASK); // setpgrp() of a forked child
+    posix_spawnattr_setpgroup(&attr, pgroup);
+    pid_t pid = -1;
+    int err = 0;
+    if (!bashRequired) {
+        err = posix_spawn(&pid, execPath.c_str(), &actions, &attr, getArgs(), environ);
+    }
+    bool fellBack = !bashRequired && (err == ENOENT || err == ENOEXEC);
+    if (bashRequired || fellBack) { // bash line, the binary vanished since lookup, or a script without #!
+        char arg0[] = "/bin/bash";
+        char arg1[] = "-c";
+        char* bashArgs[4] = {arg0, arg1, getBody(), nullptr};
+        err = posix_spawn(&pid, "/bin/bash", &actions, &attr, bashArgs, environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        errno = err;
+        perror("smash error: posix_spawn failed");
+        errno = err; //the caller's exit status: 127 not found, 126 anything else
+        return -1;
+    }
+    SmallShell::getInstance().noteExec(!bashRequired && !fellBack, getCommandLine());
+    return pid;
+}
+
+void ExternalCommand::execBash() {
+    char arg0[] = "/bin/bash";
+    char arg1[] = "-c";
+    char* bashArgs[4] = {arg0, arg1, getBody(), nullptr};
+    if (execv("/bin/bash", bashArgs) == -1) {
+        perror("smash error: execv failed");
+        exit(errno == ENOENT ? 127 : 126);
+    }
+}
+
+
+TimeoutCommand::TimeoutCommand(const char *cmd_line) : Command(cmd_line) {}
+
+void TimeoutCommand::execute() { // timeout [-k <grace>] <duration> <command>
+    int durationArg = 1;
+    double grace = 0;
+    if (getArgCount() > 1 && strcmp(getArg(1), "-k") == 0) {
+        durationArg = 3;
+    }
+    if (getArgCount() < durationArg + 2) {
+        std::cerr << "smash error: timeout: invalid arguments" << std::endl;
+        return;
+    }
+    double timeout = 0;
+    try {
+        timeout = std::stod(getArg(durationArg));
+        if (durationArg == 3) {
+            grace = std::stod(getArg(2));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "smash error: timeout: invalid arguments" << std::endl;
+        return;
+    }
+    if (timeout <= 0 || grace < 0) {
+        std::cerr << "smash error: timeout: invalid arguments" << std::endl;
+        return;
+    }
+    SmallShell& smash = SmallShell::getInstance();
+    smash.setTimeoutDuration(timeout, grace);
+    std::string commandLine = getCommandLine();
+    smash.setTimeoutOriginalCommandLine(commandLine); //with "timeout"
+    for (int i = 0; i <= durationArg; ++i) { //remove "timeout", "[-k <grace>]" and "<duration>"
+        size_t index = commandLine.find_first_of(WHITESPACE);
+        commandLine = _trim(commandLine.substr(index));
+    }
+    smash.executeCommand(commandLine.c_str());
+}
+
+static bool _writeBytes(int fd, const char* data, size_t length) {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(fd, data + written, length - written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("smash error: write failed");
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+// one write(2) for the whole output instead of a flush per line
+static void _writeAll(int fd, const std::string& out) {
+    SmallShell::getInstance().flushOutput();
+    _writeBytes(fd, out.data(), out.length());
+}
+
+// the first/last byte filter: candidates are positions holding both the pattern's first byte and,
+// length - 1 further, its last one; only those are compared in full
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static const char* _findSse2(const char* data, size_t length, const std::string& pattern) {
+    size_t n = pattern.size();
+    const __m128i first = _mm_set1_epi8(pattern[0]), last = _mm_set1_epi8(pattern[n - 1]);
+    size_t i = 0;
+    for (; i + n - 1 + 16 <= length; i += 16) {
+        __m128i head = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i tail = _mm_loadu_si128((const __m128i*)(data + i + n - 1));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first),
+                                                                           _mm_cmpeq_epi8(tail, last)));
+        for (; mask != 0; mask &= mask - 1) {
+            const char* candidate = data + i + __builtin_ctz(mask);
+            if (memcmp(candidate + 1, pattern.data() + 1, n - 2) == 0) {
+                return candidate;
+            }
+        }
+    }
+    return (const char*)memmem(data + i, length - i, pattern.data(), n);
+}
+
+__attribute__((target("avx2")))
+static const char* _findAvx2(const char* data, size_t length, const std::string& pattern) {
+    size_t n = pattern.size();
+    const __m256i first = _mm256_set1_epi8(pattern[0]), last = _mm256_set1_epi8(pattern[n - 1]);
+    size_t i = 0;
+    for (; i + n - 1 + 32 <= length; i += 32) {
+        __m256i head = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i tail = _mm256_loadu_si256((const __m256i*)(data + i + n - 1));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first),
+                                                                                 _mm256_cmpeq_epi8(tail, last)));
+        for (; mask != 0; mask &= mask - 1) {
+            const char* candidate = data + i + __builtin_ctz(mask);
+            if (memcmp(candidate + 1, pattern.data() + 1, n - 2) == 0) {
+                return candidate;
+            }
+        }
+    }
+    return _findSse2(data + i, length - i, pattern);
+}
+#endif
+
+typedef const char* (*FindKernel)(const char*, size_t, const std::string&);
+
+static const char* _findScalar(const char* data, size_t length, const std::string& pattern) {
+    return (const char*)memmem(data, length, pattern.data(), pattern.size());
+}
+
+static FindKernel _findKernel() { //chosen once, see $SMASH_FGREP_KERNEL
+    static FindKernel kernel = nullptr;
+    if (kernel == nullptr) {
+        SimdLevel level = _simdLevel("SMASH_FGREP_KERNEL");
+        kernel = _findScalar;
+#if defined(__x86_64__) || defined(__i386__)
+        kernel = (level == SIMD_AVX2) ? _findAvx2 : (level == SIMD_SSE2) ? _findSse2 : _findScalar;
+#endif
+        (void)level;
+    }
+    return kernel;
+}
+
+const char* FgrepCommand::find(const char* data, size_t length, const std::string& pattern) {
+    if (pattern.size() < 2) { //memchr is already vectorized, and "" is everywhere
+        return pattern.empty() ? data : (const char*)memchr(data, pattern[0], length);
+    }
+    return (length < pattern.size()) ? nullptr : _findKernel()(data, length, pattern);
+}
+
+FgrepCommand::FgrepCommand(const char* cmd_line) : BuiltInCommand(cmd_line), mode(PRINT_LINES),
+        supported(!_isBashRequired(getBody(), getArgs())), inProcess(true), patternIndex(1) {
+    for (; patternIndex < getArgCount() && getArg(patternIndex)[0] == '-' && supported; ++patternIndex) {
+        if (strcmp(getArg(patternIndex), "-c") == 0 && mode != LIST_FILES) {
+            mode = COUNT_LINES;
+        } else if (strcmp(getArg(patternIndex), "-l") == 0 && mode != COUNT_LINES) {
+            mode = LIST_FILES;
+        } else {
+            supported = false;
+        }
+    }
+    supported &= patternIndex < getArgCount();
+    if (supported) {
+        pattern = getArg(patternIndex);
+        supported = pattern.find('\n') == string::npos; //that's one pattern per line
+    }
+    for (int i = patternIndex + 1; i < getArgCount(); ++i) {
+        struct stat st;
+        inProcess &= strcmp(getArg(i), "-") != 0 && (stat(getArg(i), &st) == -1 || S_ISREG(st.st_mode));
+    }
+    inProcess &= patternIndex + 1 < getArgCount();
+}
+
+// data ends at a line end or at the end of the input; returns false once nothing more is needed
+bool FgrepCommand::searchBlock(const char* data, size_t length, const std::string& prefix, Result* result) const {
+    const char* end = data + length;
+    for (const char* line = data; line < end;) { //always at the start of a line
+        const char* hit = find(line, end - line, pattern);
+        if (hit == nullptr) {
+            break;
+        }
+        const char* lineStart = (const char*)memrchr(line, '\n', hit - line);
+        lineStart = (lineStart == nullptr) ? line : lineStart + 1;
+        const char* lineEnd = (const char*)memchr(hit, '\n', end - hit);
+        line = (lineEnd == nullptr) ? end : lineEnd + 1;
+        result->matches++;
+        if (mode == LIST_FILES) {
+            return false;
+        }
+        if (mode == PRINT_LINES) {
+            result->output += prefix;
+            result->output.append(lineStart, line - lineStart);
+            if (lineEnd == nullptr) {
+                result->output += '\n';
+            }
+        }
+    }
+    return true;
+}
+
+// regular files are mapped, anything else is read; either way the input is searched in 1 MiB blocks
+// cut after a newline, so lines never straddle two searches
+void FgrepCommand::searchFd(int fd, const std::string& prefix, Result* result,
+                            const std::function<bool()>& flush) const {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        result->error = errno;
+        result->failed = "smash error: fstat failed";
+        return;
+    }
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        off_t offset = std::min(std::max(lseek(fd, 0, SEEK_CUR), (off_t)0), st.st_size); //stdin may be part read
+        void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+            const char* end = (const char*)mapping + st.st_size;
+            for (const char* block = (const char*)mapping + offset; block < end;) {
+                const char* cut = block + std::min<size_t>(COPY_BUFFER_SIZE, end - block);
+                cut = (cut == end || (cut = (const char*)memchr(cut, '\n', end - cut)) == nullptr) ? end : cut + 1;
+                if (!searchBlock(block, cut - block, prefix, result) || !flush()) {
+                    break;
+                }
+                block = cut;
+            }
+            munmap(mapping, st.st_size);
+            return;
+        }
+    }
+    std::vector<char> buffer(COPY_BUFFER_SIZE);
+    size_t filled = 0;
+    while (true) {
+        ssize_t n = read(fd, buffer.data() + filled, buffer.size() - filled);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            result->error = errno;
+            result->failed = "smash error: read failed";
+            return;
+        }
+        filled += n;
+        const char* lastNewline = (const char*)memrchr(buffer.data(), '\n', filled);
+        size_t complete = (n == 0) ? filled : (lastNewline == nullptr) ? 0 : lastNewline + 1 - buffer.data();
+        if (!searchBlock(buffer.data(), complete, prefix, result) || !flush() || n == 0) {
+            return;
+        }
+        filled -= complete;
+        memmove(buffer.data(), buffer.data() + complete, filled);
+        if (filled == buffer.size()) { //a line longer than the buffer
+            buffer.resize(buffer.size() * 2);
+        }
+    }
+}
+
+// like grep: status 0 if a line matched, 1 if none did, 2 if an operand couldn't be read
+void FgrepCommand::execute() {
+    SmallShell& smash = SmallShell::getInstance();
+    smash.flushOutput();
+    _findKernel(); //settled before any worker needs it
+    std::vector<const char*> paths;
+    for (int i = patternIndex + 1; i < getArgCount(); ++i) {
+        paths.push_back(getArg(i));
+    }
+    bool named = paths.size() > 1;
+    if (paths.empty()) {
+        paths.push_back("-");
+    }
+    std::vector<Result> results(paths.size());
+    std::mutex lock;
+    std::condition_variable changed;
+    size_t head = 0; //the operand whose output goes out now, everything before it is printed
+    // operands print in order: the one at head writes its lines as it goes, the ones after it
+    // buffer up to 1 MiB and then wait for their turn, so memory stays bounded by the workers
+    auto flush = [&](size_t i) {
+        Result& result = results[i];
+        if (result.output.empty()) {
+            return true;
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        if (head != i && result.output.size() < COPY_BUFFER_SIZE) {
+            return true;
+        }
+        changed.wait(guard, [&]() { return head == i; });
+        guard.unlock();
+        bool written = _writeBytes(1, result.output.data(), result.output.size());
+        result.output.clear();
+        return written;
+    };
+    auto search = [&](size_t i) {
+        bool isStdin = strcmp(paths[i], "-") == 0;
+        int fd = isStdin ? 0 : open(paths[i], O_RDONLY|O_CLOEXEC);
+        if (fd == -1) {
+            results[i].error = errno;
+            results[i].failed = "smash error: open failed";
+        } else {
+            searchFd(fd, named ? string(isStdin ? "(standard input)" : paths[i]) + ":" : "", &results[i],
+                     [&, i]() { return flush(i); });
+            if (!isStdin) {
+                close(fd);
+            }
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        results[i].done = true;
+        changed.notify_all();
+    };
+    // a pool no wider than the CPUs, one file at a time each; with a single worker, this thread
+    // searches each operand when its turn comes
+    size_t workers = std::min<size_t>(paths.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; workers > 1 && i < workers; ++i) {
+        threads.push_back(std::thread([&]() {
+            for (size_t i; (i = next++) < paths.size();) {
+                search(i);
+            }
+        }));
+    }
+    int status = 1;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (workers == 1) {
+            search(i);
+        }
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [&]() { return results[i].done; });
+        }
+        Result& result = results[i];
+        if (result.error != 0) {
+            errno = result.error;
+            perror(result.failed);
+            status = 2;
+        }
+        const char* name = (strcmp(paths[i], "-") == 0) ? "(standard input)" : paths[i];
+        if (mode == COUNT_LINES && result.failed == nullptr) {
+            result.output = (named ? string(name) + ":" : "") + std::to_string(result.matches) + "\n";
+        } else if (mode == LIST_FILES && result.matches > 0) {
+            result.output = string(name) + "\n";
+        }
+        _writeBytes(1, result.output.data(), result.output.size());
+        string().swap(result.output);
+        if (result.matches > 0 && status == 1) {
+            status = 0;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        head = i + 1;
+        changed.notify_all();
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    smash.setLastStatus(status);
+}
+
+OutputBuffer::OutputBuffer(int fd, size_t size) : buffer(size), fd(fd) {
+    setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+bool OutputBuffer::flush() {
+    bool ok = _writeBytes(fd, pbase(), pptr() - pbase());
+    setp(buffer.data(), buffer.data() + buffer.size());
+    return ok;
+}
+
+int OutputBuffer::overflow(int c) {
+    if (!flush()) {
+        return traits_type::eof();
+    }
+    if (c != traits_type::eof()) {
+        *pptr() = (char)c;
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize OutputBuffer::xsputn(const char* s, std::streamsize n) {
+    if (n > epptr() - pptr()) {
+        if (!flush()) {
+            return 0;
+        }
+        if (n > epptr() - pptr()) { //bigger than the whole buffer
+            return _writeBytes(fd, s, n) ? n : 0;
+        }
+    }
+    memcpy(pptr(), s, n);
+    pbump((int)n);
+    return n;
+}
+
+static void _addUsage(struct rusage* total, const struct rusage& usage) {
+    timeradd(&total->ru_utime, &usage.ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage.ru_stime, &total->ru_stime);
+    total->ru_maxrss = std::max(total->ru_maxrss, usage.ru_maxrss); //peak of any one process
+    total->ru_minflt += usage.ru_minflt;
+    total->ru_majflt += usage.ru_majflt;
+    total->ru_nvcsw += usage.ru_nvcsw;
+    total->ru_nivcsw += usage.ru_nivcsw;
+    total->ru_inblock += usage.ru_inblock;
+    total->ru_oublock += usage.ru_oublock;
+}
+
+static double _seconds(const struct timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static std::string _describeUsage(const struct rusage& usage) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3) << "user " << _seconds(usage.ru_utime) << "s sys " <<
+           _seconds(usage.ru_stime) << "s maxrss " << usage.ru_maxrss << "KB faults " << usage.ru_majflt <<
+           "/" << usage.ru_minflt << " csw " << usage.ru_nvcsw << "/" << usage.ru_nivcsw << " io " <<
+           usage.ru_inblock << "/" << usage.ru_oublock;
+    return out.str();
+}
+
+TimeCommand::TimeCommand(const char *cmd_line) : Command(cmd_line) {}
+
+// children are reaped with wait4 and their rusage summed per process group, so what a foreground command
+// cost comes from the group; a builtin has no processes and is measured on smash itself instead
+void TimeCommand::execute() {
+    if (getArgCount() < 2) {
+        std::cerr << "smash error: time: invalid arguments" << std::endl;
+        return;
+    }
+    std::string commandLine = _trim(getCommandLine());
+    commandLine = _trim(commandLine.substr(commandLine.find_first_of(WHITESPACE)));
+    SmallShell& smash = SmallShell::getInstance();
+    JobsList* jobs = smash.getJobsListPtr();
+    struct rusage before;
+    getrusage(RUSAGE_SELF, &before);
+    jobs->resetFgUsage();
+    double start = _monotonicSeconds();
+    smash.executeCommand(commandLine.c_str());
+    double real = _monotonicSeconds() - start;
+    if (_isBackgroundComamnd(commandLine.c_str())) { //still running, its cost shows up in "jobs -v"
+        return;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3) << "real " << real << "s ";
+    int status = smash.getLastStatus();
+    if (jobs->getFgReaped() == 0 && (status == 128 + SIGTSTP || status == 128 + SIGKILL)) {
+        // stopped (now a job, its cost shows up in "jobs -v") or killed by ctrl-C: nothing was reaped to
+        // measure, and smash's own usage would be a lie
+        out << (status == 128 + SIGTSTP ? "stopped" : "killed") << "\n";
+        _writeAll(2, out.str());
+        return;
+    }
+    struct rusage usage = jobs->getFgUsage();
+    if (jobs->getFgReaped() == 0) {
+        struct rusage after;
+        getrusage(RUSAGE_SELF, &after);
+        usage = after;
+        timersub(&after.ru_utime, &before.ru_utime, &usage.ru_utime);
+        timersub(&after.ru_stime, &before.ru_stime, &usage.ru_stime);
+        usage.ru_minflt -= before.ru_minflt;
+        usage.ru_majflt -= before.ru_majflt;
+        usage.ru_nvcsw -= before.ru_nvcsw;
+        usage.ru_nivcsw -= before.ru_nivcsw;
+        usage.ru_inblock -= before.ru_inblock;
+        usage.ru_oublock -= before.ru_oublock;
+    }
+    out << _describeUsage(usage) << "\n";
+    _writeAll(2, out.str());
+}
+
+ParallelCommand::ParallelCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+
+// offset of the given word of line, words split the way Command::parse() splits them
+static size_t _wordOffset(const char* line, int word) {
+    size_t i = 0;
+    for (int w = 0; ; ++w) {
+        while (line[i] != '\0' && _isWhitespace(line[i])) {
+            ++i;
+        }
+        if (w == word || line[i] == '\0') {
+            return i;
+        }
+        while (line[i] != '\0' && !_isWhitespace(line[i])) {
+            ++i;
+        }
+    }
+}
+
+static std::string _expandTemplate(const std::string& templ, const std::string& item) {
+    if (templ.find("{}") == string::npos) {
+        return templ + " " + item;
+    }
+    std::string line = templ;
+    for (size_t at = line.find("{}"); at != string::npos; at = line.find("{}", at + item.length())) {
+        line.replace(at, 2, item);
+    }
+    return line;
+}
+
+// with -k each worker writes to its own file, copied to our stdout once every earlier item was
+static std::string _parallelOutputFile() {
+    const char* dir = getenv("TMPDIR");
+    std::string path = std::string((dir == nullptr || *dir == '\0') ? "/tmp" : dir) + "/smash-parallel-XXXXXX";
+    int fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd == -1) {
+        perror("smash error: mkostemp failed");
+        return "";
+    }
+    close(fd);
+    return path;
+}
+
+static void _emitOutputFile(const std::string& path) {
+    SmallShell::getInstance().flushOutput();
+    int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd == -1) {
+        perror("smash error: open failed");
+    } else {
+        int workers = 1;
+        CopyCommand::Strategy used;
+        off_t copied = 0;
+        CopyCommand::copyData(fd, 1, &workers, &used, &copied);
+        close(fd);
+    }
+    unlink(path.c_str());
+}
+
+// every item runs as an ordinary background job ("<line> &"), so jobs/kill/fg/bg see it; the next item is
+// started as soon as the reaper has moved a worker to the finished history. ctrl-C stops starting new ones
+// and leaves the running workers as jobs.
+void ParallelCommand::execute() {
+    long maxRunning = sysconf(_SC_NPROCESSORS_ONLN);
+    bool keepOrder = false;
+    const char* itemsFile = nullptr;
+    int arg = 1;
+    try {
+        for (; arg < getArgCount() && getArg(arg)[0] == '-'; ++arg) {
+            if (strcmp(getArg(arg), "-k") == 0) {
+                keepOrder = true;
+            } else if (strcmp(getArg(arg), "-j") == 0 && arg + 1 < getArgCount()) {
+                maxRunning = std::stol(getArg(++arg));
+            } else if (strcmp(getArg(arg), "-a") == 0 && arg + 1 < getArgCount()) {
+                itemsFile = getArg(++arg);
+            } else {
+                throw std::invalid_argument(getArg(arg));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "smash error: parallel: invalid arguments" << std::endl;
+        return;
+    }
+    int separator = arg;
+    while (separator < getArgCount() && strcmp(getArg(separator), ":::") != 0) {
+        ++separator;
+    }
+    if (separator == arg || maxRunning < 1) {
+        std::cerr << "smash error: parallel: invalid arguments" << std::endl;
+        return;
+    }
+    const char* body = getBody();
+    std::string templ = _rtrim(std::string(body + _wordOffset(body, arg), body + _wordOffset(body, separator)));
+    std::vector<std::string> items;
+    if (separator < getArgCount()) {
+        for (int i = separator + 1; i < getArgCount(); ++i) {
+            items.push_back(getArg(i));
+        }
+    } else if (itemsFile != nullptr) {
+        std::ifstream in(itemsFile);
+        if (!in) {
+            perror("smash error: open failed");
+            return;
+        }
+        for (std::string line; std::getline(in, line); ) {
+            if (!_trim(line).empty()) {
+                items.push_back(_trim(line));
+            }
+        }
+    } else { //the rest of our own input
+        for (std::string line; EventLoop::getInstance().readLine(&line); ) {
+            if (!_trim(line).empty()) {
+                items.push_back(_trim(line));
+            }
+        }
+    }
+    SmallShell& smash = SmallShell::getInstance();
+    std::vector<pid_t> workers(items.size(), 0); //0 until started
+    std::vector<bool> finished(items.size(), false);
+    std::vector<std::string> outputs(items.size());
+    size_t next = 0;
+    size_t emitted = 0; //every item before this one finished and, with -k, had its output copied out
+    long running = 0;
+    int failed = 0;
+    bool interrupted = false;
+    while (emitted < items.size()) {
+        while (!interrupted && running < maxRunning && next < items.size()) {
+            std::string line = _expandTemplate(templ, items[next]);
+            if (keepOrder && _findUnquoted(line, ">") == string::npos) {
+                outputs[next] = _parallelOutputFile();
+                if (!outputs[next].empty()) {
+                    line += " > " + outputs[next];
+                }
+            }
+            pid_t before = smash.getLastBackgroundPid();
+            smash.executeCommand((line + " &").c_str());
+            if (smash.getLastBackgroundPid() == before) { //nothing was launched, it already reported why
+                finished[next] = true;
+                failed++;
+            } else {
+                workers[next] = smash.getLastBackgroundPid();
+                running++;
+            }
+            next++;
+        }
+        for (size_t i = emitted; i < next; ++i) {
+            if (finished[i] || jobs->getJobByPid(workers[i]) != nullptr) {
+                continue;
+            }
+            finished[i] = true;
+            running--;
+            int status = jobs->getFinishedStatus(workers[i]);
+            if (status != -1 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+                failed++;
+            }
+        }
+        while (emitted < next && finished[emitted]) {
+            if (!outputs[emitted].empty()) {
+                _emitOutputFile(outputs[emitted]);
+                outputs[emitted].clear();
+            }
+            emitted++;
+        }
+        if (emitted == items.size() || interrupted) {
+            break;
+        }
+        if (running < maxRunning && next < items.size()) { //a slot is free already
+            continue;
+        }
+        if (!EventLoop::getInstance().waitEvents()) {
+            interrupted = true;
+        }
+    }
+    if (interrupted) {
+        for (size_t i = emitted; i < items.size(); ++i) {
+            if (!outputs[i].empty()) { //a worker still running writes on into the unlinked file
+                unlink(outputs[i].c_str());
+            }
+        }
+        std::cerr << "smash error: parallel: interrupted, " << running << " jobs left running" << std::endl;
+    }
+    smash.setLastStatus(std::min(failed, 101)); //like GNU parallel: the number of failed items
+}
+
+JobsLimitCommand::JobsLimitCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+void JobsLimitCommand::execute() {
+    SmallShell& smash = SmallShell::getInstance();
+    if (getArgCount() == 1) {
+        JobsList* jobs = smash.getJobsListPtr();
+        std::cout << "smash: jobs limit is ";
+        if (smash.getJobsLimit() == 0) {
+            std::cout << "unlimited";
+        } else {
+            std::cout << smash.getJobsLimit();
+        }
+        std::cout << " (" << jobs->getRunningCount() << " running, " << jobs->getQueuedCount() << " queued)" <<
+                  std::endl;
+        return;
+    }
+    int limit = -1;
+    try {
+        limit = (getArgCount() == 2) ? std::stoi(getArg(1)) : -1;
+    } catch (const std::exception& e) {
+        limit = -1;
+    }
+    if (limit < 0) {
+        std::cerr << "smash error: jobslimit: invalid arguments" << std::endl;
+        return;
+    }
+    smash.setJobsLimit(limit); //a higher limit lets queued jobs start right after this command
+}
+
+long long ShellStats::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+const char* ShellStats::phaseName(int phase) {
+    const char* names[] = {"command", "parse", "launch", "wait", "reap", "signal"};
+    return names[phase];
+}
+
+int ShellStats::Histogram::bucketOf(unsigned long long ns) {
+    if (ns < 8) {
+        return (int)ns;
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    return (exponent - 2) * 8 + (int)((ns >> (exponent - 3)) & 7);
+}
+
+unsigned long long ShellStats::Histogram::bucketLow(int bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    return (8ULL + bucket % 8) << (bucket / 8 - 1);
+}
+
+void ShellStats::Histogram::reset() {
+    memset(buckets, 0, sizeof(buckets));
+    count = 0;
+    totalNs = 0;
+    maxNs = 0;
+}
+
+void ShellStats::Histogram::add(unsigned long long ns) {
+    buckets[bucketOf(ns)]++;
+    count++;
+    totalNs += ns;
+    maxNs = std::max(maxNs, ns);
+}
+
+unsigned long long ShellStats::Histogram::percentile(double p) const { //upper end of the bucket holding it
+    unsigned long long rank = (unsigned long long)(p * count + 0.999999);
+    unsigned long long seen = 0;
+    for (int b = 0; b < STATS_BUCKETS && count > 0; ++b) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            return std::min(maxNs, b + 1 < STATS_BUCKETS ? bucketLow(b + 1) - 1 : maxNs);
+        }
+    }
+    return maxNs;
+}
+
+void ShellStats::record(Phase phase, long long start) {
+    if (start == 0) {
+        return;
+    }
+    phases[phase].add((unsigned long long)std::max(0LL, now() - start));
+}
+
+void ShellStats::recordCommand(const char* cmd_line, long long start) {
+    long long ns = std::max(0LL, now() - start);
+    const char* name = cmd_line;
+    while (_isWhitespace(*name)) {
+        name++;
+    }
+    size_t length = 0;
+    while (name[length] != '\0' && !_isWhitespace(name[length]) && name[length] != '&') {
+        length++;
+    }
+    if (length == 0) {
+        return;
+    }
+    CommandCounter& counter = commands[std::string(name, length)];
+    counter.count++;
+    counter.totalNs += ns;
+    counter.maxNs = std::max(counter.maxNs, (unsigned long long)ns);
+}
+
+void ShellStats::reset() {
+    for (Histogram& h : phases) {
+        h.reset();
+    }
+    commands.clear();
+}
+
+static std::string _formatNs(unsigned long long ns) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    if (ns < 1000) {
+        out << ns << "ns";
+    } else if (ns < 1000000) {
+        out << ns / 1e3 << "us";
+    } else if (ns < 1000000000) {
+        out << ns / 1e6 << "ms";
+    } else {
+        out << ns / 1e9 << "s";
+    }
+    return out.str();
+}
+
+static std::string _jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+// most used first
+static std::vector<std::pair<std::string, ShellStats::CommandCounter>> _sortedCommands(
+        const std::unordered_map<std::string, ShellStats::CommandCounter>& commands) {
+    std::vector<std::pair<std::string, ShellStats::CommandCounter>> sorted(commands.begin(), commands.end());
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, ShellStats::CommandCounter>& a,
+                                               const std::pair<std::string, ShellStats::CommandCounter>& b) {
+        return a.second.count != b.second.count ? a.second.count > b.second.count : a.first < b.first;
+    });
+    return sorted;
+}
+
+std::string ShellStats::describe() const {
+    std::ostringstream out;
+    out << std::left << std::setw(10) << "phase" << std::right << std::setw(10) << "count" << std::setw(10) <<
+        "p50" << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        const Histogram& h = phases[p];
+        out << std::left << std::setw(10) << phaseName(p) << std::right << std::setw(10) << h.count <<
+            std::setw(10) << _formatNs(h.percentile(0.5)) << std::setw(10) << _formatNs(h.percentile(0.99)) <<
+            std::setw(10) << _formatNs(h.maxNs) << "\n";
+    }
+    if (!commands.empty()) {
+        out << std::left << std::setw(20) << "command" << std::right << std::setw(10) << "count" << std::setw(10) <<
+            "mean" << std::setw(10) << "max" << "\n";
+    }
+    for (const std::pair<std::string, CommandCounter>& c : _sortedCommands(commands)) {
+        out << std::left << std::setw(20) << c.first << std::right << std::setw(10) << c.second.count <<
+            std::setw(10) << _formatNs(c.second.totalNs / c.second.count) << std::setw(10) <<
+            _formatNs(c.second.maxNs) << "\n";
+    }
+    return out.str();
+}
+
+std::string ShellStats::toJson() const {
+    SmallShell& smash = SmallShell::getInstance();
+    std::ostringstream out;
+    out << "{\"enabled\": " << (enabled ? "true" : "false") << ", \"exec\": {\"direct\": " <<
+        smash.getDirectExecCount() << ", \"bash\": " << smash.getBashExecCount() << "}, \"phases\": {";
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        const Histogram& h = phases[p];
+        out << (p ? ", " : "") << "\"" << phaseName(p) << "\": {\"count\": " << h.count << ", \"total_ns\": " <<
+            h.totalNs << ", \"p50_ns\": " << h.percentile(0.5) << ", \"p99_ns\": " << h.percentile(0.99) <<
+            ", \"max_ns\": " << h.maxNs << "}";
+    }
+    out << "}, \"commands\": {";
+    bool first = true;
+    for (const std::pair<std::string, CommandCounter>& c : _sortedCommands(commands)) {
+        out << (first ? "" : ", ") << _jsonString(c.first) << ": {\"count\": " << c.second.count <<
+            ", \"total_ns\": " << c.second.totalNs << ", \"max_ns\": " << c.second.maxNs << "}";
+        first = false;
+    }
+    out << "}}\n";
+    return out.str();
+}
+
+StatsCommand::StatsCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+void StatsCommand::execute() {
+    SmallShell& smash = SmallShell::getInstance();
+    ShellStats* stats = smash.getStatsPtr();
+    if (getArgCount() == 1) {
+        std::ostringstream out;
+        out << "smash: stats are " << (stats->isEnabled() ? "on" : "off") << ", exec: direct " <<
+            smash.getDirectExecCount() << " bash " << smash.getBashExecCount() << "\n" << stats->describe();
+        _writeAll(1, out.str());
+    } else if (getArgCount() == 2 && strcmp(getArg(1), "on") == 0) {
+        stats->setEnabled(true);
+    } else if (getArgCount() == 2 && strcmp(getArg(1), "off") == 0) {
+        stats->setEnabled(false);
+    } else if (getArgCount() == 2 && strcmp(getArg(1), "reset") == 0) {
+        stats->reset();
+    } else if (getArgCount() == 2 && strcmp(getArg(1), "-j") == 0) {
+        _writeAll(1, stats->toJson());
+    } else {
+        std::cerr << "smash error: stats: invalid arguments" << std::endl;
+    }
+}
+
+static bool _writeFile(const std::string& path, const std::string& text) {
+    int fd = open(path.c_str(), O_WRONLY|O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = (write(fd, text.data(), text.length()) == (ssize_t)text.length());
+    close(fd);
+    return ok;
+}
+
+static std::string _readFile(const std::string& path) {
+    std::ifstream in(path);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+// 2G, 512M, 64K or plain bytes
+static bool _parseSize(const char* text, long long* bytes) {
+    char* end = nullptr;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (errno != 0 || end == text || value <= 0) {
+        return false;
+    }
+    switch (*end) {
+        case 'K': case 'k': value *= 1024; end++; break;
+        case 'M': case 'm': value *= 1024 * 1024; end++; break;
+        case 'G': case 'g': value *= 1024 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    *bytes = (long long)value;
+    return *end == '\0' && *bytes > 0;
+}
+
+static std::string _formatSize(unsigned long long bytes) {
+    const char* units[] = {"", "K", "M", "G", "T"};
+    int unit = 0;
+    while (unit < 4 && bytes >= 1024 && bytes % 1024 == 0) {
+        bytes /= 1024;
+        unit++;
+    }
+    return std::to_string(bytes) + units[unit];
+}
+
+bool ResourceLimits::apply(pid_t pid) const {
+    struct rlimit limit;
+    bool ok = true;
+    if (memBytes != 0) {
+        limit.rlim_cur = limit.rlim_max = memBytes;
+        ok = (prlimit(pid, RLIMIT_AS, &limit, nullptr) == 0) && ok;
+    }
+    if (cpuSeconds != 0) {
+        limit.rlim_cur = cpuSeconds;
+        limit.rlim_max = cpuSeconds + 1;
+        ok = (prlimit(pid, RLIMIT_CPU, &limit, nullptr) == 0) && ok;
+    }
+    if (openFiles != 0) {
+        limit.rlim_cur = limit.rlim_max = openFiles;
+        ok = (prlimit(pid, RLIMIT_NOFILE, &limit, nullptr) == 0) && ok;
+    }
+    if (!ok && (pid == 0 || errno != ESRCH)) { //smash may be late, the child has set them itself then
+        perror("smash error: prlimit failed");
+    }
+    return ok;
+}
+
+// a sibling of smash's own cgroup can't be used without moving smash, so the job's cgroup is a child of it;
+// that needs the memory/cpu controllers enabled for smash's cgroup, which only works where it's delegated to us
+std::string ResourceLimits::createCgroup(const std::string& name) const {
+    if (memBytes == 0 && cpus == 0) {
+        return "";
+    }
+    std::string self = _readFile("/proc/self/cgroup");
+    size_t unified = self.find("0::");
+    std::string root = "/sys/fs/cgroup";
+    if (access((root + "/cgroup.controllers").c_str(), F_OK) == -1) { //hybrid layout, v2 mounted beside v1
+        root += "/unified";
+    }
+    if (unified == string::npos || access((root + "/cgroup.controllers").c_str(), F_OK) == -1) { //no cgroup v2
+        return "";
+    }
+    std::string parent = root + _trim(self.substr(unified + 3, self.find('\n', unified) - unified - 3));
+    std::string path = parent + "/" + name;
+    if (mkdir(path.c_str(), 0755) == -1) {
+        return "";
+    }
+    bool ok = true;
+    if (memBytes != 0) {
+        std::string max = std::to_string(memBytes);
+        ok = _writeFile(path + "/memory.max", max) ||
+             (_writeFile(parent + "/cgroup.subtree_control", "+memory") && _writeFile(path + "/memory.max", max));
+    }
+    if (ok && cpus != 0) {
+        std::string max = std::to_string((long long)(cpus * 100000)) + " 100000";
+        ok = _writeFile(path + "/cpu.max", max) ||
+             (_writeFile(parent + "/cgroup.subtree_control", "+cpu") && _writeFile(path + "/cpu.max", max));
+    }
+    if (!ok) {
+        rmdir(path.c_str());
+        return "";
+    }
+    return path;
+}
+
+bool ResourceLimits::joinCgroup(const std::string& path) {
+    if (!_writeFile(path + "/cgroup.procs", "0")) {
+        perror("smash error: cgroup join failed");
+        return false;
+    }
+    return true;
+}
+
+bool ResourceLimits::wasOomKilled(const std::string& path) {
+    if (path.empty()) {
+        return false;
+    }
+    std::string events = _readFile(path + "/memory.events");
+    size_t at = events.find("oom_kill ");
+    return at != string::npos && strtoull(events.c_str() + at + 9, nullptr, 10) > 0;
+}
+
+// what the job really runs with: the leader's rlimits and the cgroup's files, as far as they can still be read
+std::string ResourceLimits::describe(pid_t pid, const std::string& cgroup) const {
+    std::ostringstream out;
+    struct rlimit limit;
+    const char* separator = "";
+    if (memBytes != 0) {
+        unsigned long long mem = memBytes;
+        if (prlimit(pid, RLIMIT_AS, nullptr, &limit) == 0) {
+            mem = limit.rlim_cur;
+        }
+        out << separator << "mem " << _formatSize(mem);
+        separator = ", ";
+    }
+    if (cpuSeconds != 0) {
+        long cpu = cpuSeconds;
+        if (prlimit(pid, RLIMIT_CPU, nullptr, &limit) == 0) {
+            cpu = (long)limit.rlim_cur;
+        }
+        out << separator << "cpu " << cpu << "s";
+        separator = ", ";
+    }
+    if (openFiles != 0) {
+        long files = openFiles;
+        if (prlimit(pid, RLIMIT_NOFILE, nullptr, &limit) == 0) {
+            files = (long)limit.rlim_cur;
+        }
+        out << separator << "nofile " << files;
+        separator = ", ";
+    }
+    if (cpus != 0) {
+        out << separator << "cpus " << cpus;
+        separator = ", ";
+    }
+    if (!cgroup.empty()) {
+        std::string memoryMax = _trim(_readFile(cgroup + "/memory.max"));
+        std::string cpuMax = _trim(_readFile(cgroup + "/cpu.max"));
+        out << separator << "cgroup memory.max " << (memoryMax.empty() ? "-" : memoryMax) << " cpu.max " <<
+            (cpuMax.empty() ? "-" : cpuMax);
+    } else if (memBytes != 0 || cpus != 0) {
+        out << separator << "no cgroup";
+    }
+    return out.str();
+}
+
+std::string ResourceLimits::killReason(int status, const struct rusage& usage, bool oomKilled) const {
+    if (status == -1 || !WIFSIGNALED(status)) {
+        return "";
+    }
+    int sig = WTERMSIG(status);
+    if (memBytes != 0 && oomKilled) {
+        return "memory limit (" + _formatSize(memBytes) + ")";
+    }
+    if (cpuSeconds != 0 && (sig == SIGXCPU ||
+            (sig == SIGKILL && usage.ru_utime.tv_sec + usage.ru_stime.tv_sec >= cpuSeconds))) {
+        return "CPU time limit (" + std::to_string(cpuSeconds) + "s)";
+    }
+    return "";
+}
+
+LimitCommand::LimitCommand(const char* cmd_line) : Command(cmd_line) {}
+
+void LimitCommand::execute() {
+    ResourceLimits limits;
+    int arg = 1;
+    try {
+        for (; arg + 1 < getArgCount() && strncmp(getArg(arg), "--", 2) == 0; arg += 2) {
+            const char* value = getArg(arg + 1);
+            if (strcmp(getArg(arg), "--mem") == 0) {
+                if (!_parseSize(value, &limits.memBytes)) {
+                    throw std::invalid_argument(value);
+                }
+            } else if (strcmp(getArg(arg), "--cpu") == 0) {
+                limits.cpuSeconds = std::stol(value);
+            } else if (strcmp(getArg(arg), "--nofile") == 0) {
+                limits.openFiles = std::stol(value);
+            } else if (strcmp(getArg(arg), "--cpus") == 0) {
+                limits.cpus = std::stod(value);
+            } else {
+                throw std::invalid_argument(getArg(arg));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "smash error: limit: invalid arguments" << std::endl;
+        return;
+    }
+    if (arg >= getArgCount() || !limits.isSet() || limits.cpuSeconds < 0 || limits.openFiles < 0 ||
+            limits.cpus < 0) {
+        std::cerr << "smash error: limit: invalid arguments" << std::endl;
+        return;
+    }
+    SmallShell& smash = SmallShell::getInstance();
+    smash.setLimits(limits);
+    std::string commandLine = getCommandLine();
+    smash.executeCommand(commandLine.substr(_wordOffset(commandLine.c_str(), arg)).c_str());
+}
+
+// "0-3,8,10-11"
+static bool _parseCpuList(const char* text, cpu_set_t* cpus) {
+    CPU_ZERO(cpus);
+    const char* p = text;
+    while (*p != '\0') {
+        char* end = nullptr;
+        if (!isdigit((unsigned char)*p)) {
+            return false;
+        }
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            if (!isdigit((unsigned char)*p)) {
+                return false;
+            }
+            last = strtol(p, &end, 10);
+        }
+        if (last < first || last >= CPU_SETSIZE) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            CPU_SET(cpu, cpus);
+        }
+        if (*end == ',') {
+            end++;
+            if (*end == '\0') {
+                return false;
+            }
+        } else if (*end != '\0') {
+            return false;
+        }
+        p = end;
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+
+static std::string _formatCpuList(const cpu_set_t& cpus) {
+    std::string list;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &cpus)) {
+            continue;
+        }
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &cpus)) {
+            last++;
+        }
+        list += (list.empty() ? "" : ",") + std::to_string(cpu);
+        if (last > cpu) {
+            list += "-" + std::to_string(last);
+        }
+        cpu = last;
+    }
+    return list;
+}
+
+PinCommand::PinCommand(const char* cmd_line) : Command(cmd_line) {}
+
+void PinCommand::execute() {
+    cpu_set_t cpus, allowed;
+    if (getArgCount() < 3 || !_parseCpuList(getArg(1), &cpus)) {
+        std::cerr << "smash error: pin: invalid arguments" << std::endl;
+        return;
+    }
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        perror("smash error: sched_getaffinity failed");
+        return;
+    }
+    CPU_AND(&allowed, &allowed, &cpus);
+    if (CPU_COUNT(&allowed) == 0) {
+        std::cerr << "smash error: pin: none of cpus " << _formatCpuList(cpus) << " are available" << std::endl;
+        return;
+    }
+    SmallShell& smash = SmallShell::getInstance();
+    smash.setPinnedCpus(cpus);
+    std::string commandLine = getCommandLine();
+    smash.executeCommand(commandLine.substr(_wordOffset(commandLine.c_str(), 2)).c_str());
+}
+
+PlacementCommand::PlacementCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
+
+void PlacementCommand::execute() {
+    SmallShell& smash = SmallShell::getInstance();
+    const char* names[] = {"off", "cores", "nodes"};
+    if (getArgCount() == 1) {
+        cpu_set_t cpus;
+        if (sched_getaffinity(0, sizeof(cpus), &cpus) == -1) {
+            perror("smash error: sched_getaffinity failed");
+            return;
+        }
+        std::cout << "smash: placement is " << names[smash.getPlacementPolicy()] << " (cpus " <<
+                  _formatCpuList(cpus) << ", " << smash.getNumaNodes().size() << " nodes)" << std::endl;
+        return;
+    }
+    for (int policy = 0; policy < 3; ++policy) {
+        if (getArgCount() == 2 && strcmp(getArg(1), names[policy]) == 0) {
+            smash.setPlacementPolicy(policy);
+            return;
+        }
+    }
+    std::cerr << "smash error: placement: invalid arguments" << std::endl;
+}
+
+static long long _realtimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void _copyCommandLine(char* dst, size_t size, const std::string& commandLine) {
+    size_t length = std::min(size - 1, commandLine.length());
+    memcpy(dst, commandLine.data(), length);
+    memset(dst + length, 0, size - length);
+}
+
+bool JobsPublisher::open(pid_t smashPid) {
+    path = "/dev/shm/smash-" + std::to_string(smashPid);
+    size = sizeof(SmashShmHeader) + SMASH_SHM_JOBS * sizeof(SmashShmJob) + SMASH_SHM_EVENTS * sizeof(SmashShmEvent);
+    // /dev/shm is shared by everyone and the name is predictable: only a file this call created
+    // will do, never one planted there (or a symlink), and only its owner may read it. One left
+    // behind by an earlier smash with the same pid is removed - unlink(2) in the sticky /dev/shm
+    // only succeeds for our own files
+    int fd = ::open(path.c_str(), O_RDWR|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC, 0600);
+    if (fd == -1 && errno == EEXIST && unlink(path.c_str()) == 0) {
+        fd = ::open(path.c_str(), O_RDWR|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC, 0600);
+    }
+    if (fd == -1) {
+        perror("smash error: open failed");
+        path.clear();
+        return false;
+    }
+    if (ftruncate(fd, (off_t)size) == -1) {
+        perror("smash error: ftruncate failed");
+        ::close(fd);
+        unlink(path.c_str());
+        path.clear();
+        return false;
+    }
+    void* m = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        perror("smash error: mmap failed");
+        unlink(path.c_str());
+        path.clear();
+        return false;
+    }
+    mapping = (char*)m;
+    ownerPid = getpid();
+    SmashShmHeader* header = (SmashShmHeader*)mapping; //the file is fresh, so all zero
+    header->version = SMASH_SHM_VERSION;
+    header->headerSize = sizeof(SmashShmHeader);
+    header->jobSize = sizeof(SmashShmJob);
+    header->eventSize = sizeof(SmashShmEvent);
+    header->jobCapacity = SMASH_SHM_JOBS;
+    header->ringCapacity = SMASH_SHM_EVENTS;
+    header->smashPid = smashPid;
+    header->jobsOffset = sizeof(SmashShmHeader);
+    header->ringOffset = sizeof(SmashShmHeader) + SMASH_SHM_JOBS * sizeof(SmashShmJob);
+    __atomic_store_n(&header->magic, SMASH_SHM_MAGIC, __ATOMIC_RELEASE); //last, readers check it first
+    return true;
+}
+
+bool JobsPublisher::isPublishing() const {
+    return mapping != nullptr && getpid() == ownerPid;
+}
+
+void JobsPublisher::close() {
+    if (!isPublishing()) {
+        return;
+    }
+    SmashShmHeader* header = (SmashShmHeader*)mapping;
+    __atomic_fetch_or(&header->flags, SMASH_SHM_CLOSED, __ATOMIC_RELEASE);
+    munmap(mapping, size);
+    unlink(path.c_str()); //readers that have it mapped keep their view
+    mapping = nullptr;
+    path.clear();
+}
+
+JobsPublisher::~JobsPublisher() {
+    close();
+}
+
+// seqlock writer: odd while the table changes
+void JobsPublisher::setJob(int jobId, pid_t pid, int state, time_t startTime, const std::string& commandLine,
+                           int jobCount) {
+    if (!isPublishing()) {
+        return;
+    }
+    SmashShmHeader* header = (SmashShmHeader*)mapping;
+    uint64_t seq = header->tableSeq;
+    __atomic_store_n(&header->tableSeq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (jobId >= 1 && (unsigned)jobId <= SMASH_SHM_JOBS) {
+        SmashShmJob* job = (SmashShmJob*)(mapping + header->jobsOffset) + (jobId - 1);
+        job->jobId = jobId;
+        job->pid = pid;
+        job->state = state;
+        job->startTimeNs = (long long)startTime * 1000000000LL;
+        _copyCommandLine(job->commandLine, sizeof(job->commandLine), commandLine);
+    }
+    header->jobCount = jobCount;
+    __atomic_store_n(&header->tableSeq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void JobsPublisher::clearJob(int jobId, int jobCount) {
+    if (!isPublishing()) {
+        return;
+    }
+    SmashShmHeader* header = (SmashShmHeader*)mapping;
+    uint64_t seq = header->tableSeq;
+    __atomic_store_n(&header->tableSeq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (jobId >= 1 && (unsigned)jobId <= SMASH_SHM_JOBS) {
+        memset((SmashShmJob*)(mapping + header->jobsOffset) + (jobId - 1), 0, sizeof(SmashShmJob));
+    }
+    header->jobCount = jobCount;
+    __atomic_store_n(&header->tableSeq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void JobsPublisher::pushEvent(int type, int jobId, pid_t pid, int status, const std::string& commandLine) {
+    if (!isPublishing()) {
+        return;
+    }
+    SmashShmHeader* header = (SmashShmHeader*)mapping;
+    uint64_t n = header->eventCount;
+    SmashShmEvent* event = (SmashShmEvent*)(mapping + header->ringOffset) + (n % SMASH_SHM_EVENTS);
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED); //a reader still copying the old event will see it changed
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event->timeNs = _realtimeNs();
+    event->type = type;
+    event->jobId = jobId;
+    event->pid = pid;
+    event->status = status;
+    _copyCommandLine(event->commandLine, sizeof(event->commandLine), commandLine);
+    __atomic_store_n(&event->seq, n + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->eventCount, n + 1, __ATOMIC_RELEASE);
+}
+
+JobsList::JobsList() : slots(), pidIndex(), jobsCount(0), lastStoppedId(0), stoppedCount(0), queuedIds(), finishedJobs(),
+        unclaimedExits(),
+        unclaimedUsage(), fgPid(0), fgCommandLine(), fgStatusPid(0), fgStatus(-1), fgUsage(), fgReaped(0),
+        publisher(nullptr) {}
+
+void JobsList::printJobsList(JobMonitor* monitor, bool placement) {
+    removeFinishedJobs();
+    time_t currentTime = time(nullptr);
+    if (currentTime == -1) {
+        perror("smash error: time failed");
+    }
+    std::unordered_map<pid_t, JobMonitor::JobSample> samples;
+    if (monitor) {
+        std::unordered_set<pid_t> groups;
+        for (const std::pair<const pid_t, int>& p : pidIndex) {
+            groups.insert(p.first);
+        }
+        monitor->sample(groups, &samples);
+    }
+    std::ostringstream out;
+    for (const JobEntry& j : slots) {
+        if (j.getJobId() == 0) {
+            continue;
+        }
+        if (j.isQueued()) {
+            out << "[" << j.getJobId() << "] " << j.getCommandLine() << " : queued\n";
+            continue;
+        }
+        out << "[" << j.getJobId() << "] " <<
+                  j.getCommandLine() << " : " <<
+                  j.getPid() << " " <<
+                  difftime(currentTime, j.getInsertionTime()) << " secs";
+        if (j.isStopped()) {
+            out << " (stopped)";
+        }
+        if (j.limits.isSet()) {
+            out << " [" << j.limits.describe(j.getPid(), j.cgroup) << "]";
+        }
+        cpu_set_t cpus;
+        if (placement && sched_getaffinity(j.getPid(), sizeof(cpus), &cpus) == 0) { //live: taskset may have moved it
+            out << " [cpus " << _formatCpuList(cpus) << "]";
+        }
+        if (monitor) {
+            const JobMonitor::JobSample& sample = samples[j.getPid()];
+            out << " [" << sample.processes << " procs, " << sample.threads << " threads, cpu " << std::fixed <<
+                   std::setprecision(1) << sample.cpuPercent << "%, rss " << sample.rssKb << "KB, read " <<
+                   sample.readBytes << "B, write " << sample.writeBytes << "B]" << std::defaultfloat;
+        }
+        out << "\n";
+    }
+    _writeAll(1, out.str());
+}
+
+void JobsList::killAllJobs() { // (print format in pdf p.9), queued jobs are just dropped
+    std::ostringstream out;
+    out << "smash: sending SIGKILL signal to " << jobsCount - queuedIds.size() << " jobs:\n";
+    for (const JobEntry &j : slots) {
+        if (j.getJobId() != 0 && !j.isQueued()) {
+            out << j.getPid() << ": " << j.getCommandLine() << "\n";
+        }
+    }
+    _writeAll(1, out.str());
+    for (const JobEntry &j : slots) {
+        if (j.getJobId() != 0 && !j.isQueued() && kill((-1)*j.getPid(), SIGKILL) == -1) {
+            perror("smash error: kill failed");
+            return;
+        }
+    }
+    for (const JobEntry &j : slots) {
+        if (j.pidfd != -1) {
+            close(j.pidfd);
+        }
+        if (publisher && j.getJobId() != 0) {
+            publisher->clearJob(j.getJobId(), 0);
+        }
+    }
+    slots.clear();
+    pidIndex.clear();
+    jobsCount = 0;
+    lastStoppedId = 0;
+    stoppedCount = 0;
+    queuedIds.clear();
+}
+
+volatile sig_atomic_t JobsList::childExited = 0;
+
+// Only runs after SIGCHLD. Each exited child is peeked at (WNOWAIT) so its process group can still
+// be read, then reaped; the cost follows the number of exits, not the number of jobs.
+void JobsList::removeFinishedJobs() {
+    if (!childExited) {
+        return;
+    }
+    childExited = 0;
+    ShellStats::Timer timer(SmallShell::getInstance().getStatsPtr(), ShellStats::PHASE_REAP);
+    std::unordered_map<pid_t, int> affected; // pgid -> last status reaped from it
+    while (true) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WEXITED|WNOHANG|WNOWAIT) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != ECHILD) {
+                perror("smash error: waitid failed");
+            }
+            break;
+        }
+        if (info.si_pid == 0) { //nothing else has exited
+            break;
+        }
+        pid_t pid = info.si_pid;
+        pid_t pgid = getpgid(pid); //still valid for a zombie
+        if (pgid == -1) {
+            pgid = pid;
+        }
+        int status = 0;
+        struct rusage usage;
+        if (wait4(pid, &status, WNOHANG, &usage) <= 0) { //someone else reaped it first
+            continue;
+        }
+        noteReaped(pid, pgid, status, usage);
+        affected[pgid] = status;
+    }
+    for (const std::pair<const pid_t, int>& a : affected) {
+        if (kill(-a.first, 0) == 0 || errno != ESRCH) { //other processes of the job still run
+            continue;
+        }
+        SmallShell::getInstance().getTimeoutsPtr()->cancel(a.first);
+        JobEntry* j = getJobByPid(a.first);
+        if (j == nullptr) { //exited before addJob() saw it
+            unclaimedExits[a.first] = a.second;
+            continue;
+        }
+        j->setExitStatus(a.second);
+        if (!j->cgroup.empty()) { //empty now, its OOM count is the last thing to read
+            j->oomKilled = ResourceLimits::wasOomKilled(j->cgroup);
+            rmdir(j->cgroup.c_str());
+        }
+        addFinishedJob(*j);
+        removeJob(a.first);
+    }
+}
+
+void JobsList::noteReaped(pid_t pid, pid_t pgid, int status, const struct rusage& usage) {
+    if (pid == fgStatusPid) {
+        fgStatus = status;
+    }
+    if (pgid == fgPid) {
+        _addUsage(&fgUsage, usage);
+        fgReaped++;
+        return;
+    }
+    JobEntry* j = getJobByPid(pgid);
+    _addUsage(j ? &j->usage : &unclaimedUsage[pgid], usage);
+}
+
+void JobsList::resetFgUsage() {
+    memset(&fgUsage, 0, sizeof(fgUsage));
+    fgReaped = 0;
+}
+
+void JobsList::addFinishedJob(const JobEntry& j) {
+    finishedJobs.push_back(j);
+    finishedJobs.back().pidfd = -1; //owned by the live slot
+    if (finishedJobs.size() > FINISHED_JOBS_HISTORY) {
+        finishedJobs.pop_front();
+    }
+}
+
+void JobsList::printFinishedJobs() {
+    std::ostringstream out;
+    for (const JobEntry& j : finishedJobs) {
+        out << "[" << j.getJobId() << "] " <<
+                  j.getCommandLine() << " : " <<
+                  j.getPid() << " " << j.describeExit() << " (" << _describeUsage(j.getUsage()) << ")\n";
+    }
+    _writeAll(1, out.str());
 }
 
 void JobsList::addJob(const std::string CommandLine, pid_t pid, bool isStopped) {
@@ -644,52 +3202,452 @@ void JobsList::addJob(const std::string CommandLine, pid_t pid, bool isStopped)
     if (insertionTime == -1) {
         perror("smash error: time failed");
     }
-    int jobId = 1;
-    if (!jobsList.empty()) {
-        jobId = jobsList.back().getJobId() + 1;
+    int jobId = (int)slots.size() + 1;
+    JobEntry j = JobEntry(pid, jobId, CommandLine, insertionTime);
+    std::unordered_map<pid_t, int>::iterator exited = unclaimedExits.find(pid);
+    std::unordered_map<pid_t, struct rusage>::iterator used = unclaimedUsage.find(pid);
+    if (used != unclaimedUsage.end()) {
+        j.usage = used->second;
+        unclaimedUsage.erase(used);
+    }
+    if (exited != unclaimedExits.end()) { //already finished and reaped, straight to the history
+        j.setExitStatus(exited->second);
+        unclaimedExits.erase(exited);
+        addFinishedJob(j);
+        if (publisher) {
+            publisher->pushEvent(SMASH_EVENT_STARTED, jobId, pid, -1, CommandLine);
+            publisher->pushEvent(SMASH_EVENT_FINISHED, jobId, pid, j.getExitStatus(), CommandLine);
+        }
+        return;
+    }
+    j.pidfd = EventLoop::getInstance().watchPid(pid);
+    slots.push_back(j);
+    pidIndex[pid] = jobId;
+    jobsCount++;
+    if (isStopped) {
+        linkStopped(&slots.back());
+    }
+    // /dev/shm/smash-<pid> has SMASH_SHM_JOBS (1024) slots: a job with a higher id is counted in
+    // its jobCount and gets its events, but has no slot, so monitors don't list it
+    publish(slots.back(), isStopped ? SMASH_EVENT_STOPPED : SMASH_EVENT_STARTED);
+}
+
+int JobsList::queueJob(const std::string& commandLine) {
+    time_t insertionTime = time(nullptr);
+    if (insertionTime == -1) {
+        perror("smash error: time failed");
+    }
+    int jobId = (int)slots.size() + 1;
+    slots.push_back(JobEntry(0, jobId, commandLine, insertionTime));
+    slots.back().queued = true;
+    queuedIds.push_back(jobId);
+    jobsCount++;
+    publish(slots.back(), SMASH_EVENT_QUEUED); //unlisted above SMASH_SHM_JOBS too, see addJob
+    return jobId;
+}
+
+void JobsList::startQueuedJob(int jobId, pid_t pid) { //the same entry, now with a process group
+    JobEntry* j = getJobById(jobId);
+    if (j == nullptr || !j->isQueued()) {
+        return;
+    }
+    queuedIds.remove(jobId);
+    j->queued = false;
+    j->pid = pid;
+    j->resetSecondsElapsed(); //its time in the queue doesn't count
+    std::unordered_map<pid_t, int>::iterator exited = unclaimedExits.find(pid);
+    publish(*j, SMASH_EVENT_STARTED);
+    if (exited != unclaimedExits.end()) {
+        j->setExitStatus(exited->second);
+        unclaimedExits.erase(exited);
+        addFinishedJob(*j);
+        publish(*j, SMASH_EVENT_FINISHED, j->getExitStatus());
+        clearSlot(j);
+        return;
+    }
+    j->pidfd = EventLoop::getInstance().watchPid(pid);
+    pidIndex[pid] = jobId;
+}
+
+void JobsList::setJobLimits(pid_t pid, const ResourceLimits& limits, const std::string& cgroup) {
+    JobEntry* j = getJobByPid(pid);
+    if (j == nullptr) { //already finished
+        if (!cgroup.empty()) {
+            rmdir(cgroup.c_str());
+        }
+        return;
+    }
+    j->limits = limits;
+    j->cgroup = cgroup;
+}
+
+void JobsList::cancelQueuedJob(int jobId) {
+    JobEntry* j = getJobById(jobId);
+    if (j == nullptr || !j->isQueued()) {
+        return;
+    }
+    queuedIds.remove(jobId);
+    publish(*j, SMASH_EVENT_CANCELLED);
+    clearSlot(j);
+}
+
+void JobsList::linkStopped(JobEntry* j) { //kept in job-id order, walked from the tail since new stops are usually recent jobs
+    int next = 0;
+    int prev = lastStoppedId;
+    while (prev > j->jobId) {
+        next = prev;
+        prev = slots[prev - 1].prevStopped;
+    }
+    j->prevStopped = prev;
+    j->nextStopped = next;
+    if (prev != 0) {
+        slots[prev - 1].nextStopped = j->jobId;
+    }
+    if (next != 0) {
+        slots[next - 1].prevStopped = j->jobId;
+    } else {
+        lastStoppedId = j->jobId;
+    }
+    j->stopped = true;
+    stoppedCount++;
+}
+
+void JobsList::unlinkStopped(JobEntry* j) {
+    if (!j->stopped) {
+        return;
+    }
+    if (j->prevStopped != 0) {
+        slots[j->prevStopped - 1].nextStopped = j->nextStopped;
+    }
+    if (j->nextStopped != 0) {
+        slots[j->nextStopped - 1].prevStopped = j->prevStopped;
+    } else {
+        lastStoppedId = j->prevStopped;
+    }
+    j->prevStopped = 0;
+    j->nextStopped = 0;
+    j->stopped = false;
+    stoppedCount--;
+}
+
+void JobsList::stopJob(JobEntry* j) {
+    if (!j->stopped) {
+        linkStopped(j);
+        publish(*j, SMASH_EVENT_STOPPED);
+    }
+}
+
+void JobsList::resumeJob(JobEntry* j) {
+    if (j->stopped) {
+        unlinkStopped(j);
+        publish(*j, SMASH_EVENT_RESUMED);
+    }
+}
+
+void JobsList::publish(const JobEntry& j, int event, int status) {
+    if (publisher == nullptr) {
+        return;
+    }
+    int state = j.isQueued() ? SMASH_JOB_QUEUED : (j.isStopped() ? SMASH_JOB_STOPPED : SMASH_JOB_RUNNING);
+    publisher->setJob(j.getJobId(), j.getPid(), state, j.getInsertionTime(), j.getCommandLine(), jobsCount);
+    publisher->pushEvent(event, j.getJobId(), j.getPid(), status, j.getCommandLine());
+}
+
+void JobsList::noteTimedOut(pid_t pid, const std::string& commandLine) {
+    if (publisher) {
+        JobEntry* j = getJobByPid(pid);
+        publisher->pushEvent(SMASH_EVENT_TIMED_OUT, j ? j->getJobId() : 0, pid, -1, commandLine);
     }
-    JobEntry j = JobEntry(pid, jobId, CommandLine, isStopped, insertionTime);
-    jobsList.push_back(j);
 }
 
 JobsList::JobEntry *JobsList::getLastJob(int *lastJobId) {
-    if (jobsList.empty()) {
+    if (slots.empty()) {
         return nullptr;
     }
-    *lastJobId = jobsList.back().getJobId();
-    return &jobsList.back();
+    *lastJobId = slots.back().getJobId();
+    return &slots.back();
 }
 
 JobsList::JobEntry *JobsList::getLastStoppedJob(int *jobId) {
-    for(std::list<JobEntry>::reverse_iterator it = jobsList.rbegin(); it != jobsList.rend(); it++) {
-        if (it->isStopped()) {
-            *jobId = it->getJobId();
-            return &(*it);
-        }
+    if (lastStoppedId == 0) {
+        return nullptr;
     }
-    return nullptr;
+    *jobId = lastStoppedId;
+    return &slots[lastStoppedId - 1];
 }
 
 JobsList::JobEntry *JobsList::getJobById(int jobId) {
-    for(std::list<JobEntry>::reverse_iterator it = jobsList.rbegin(); it != jobsList.rend(); it++) {
-        if (it->getJobId() == jobId) {
-            return &(*it);
+    if (jobId < 1 || jobId > (int)slots.size() || slots[jobId - 1].getJobId() == 0) {
+        return nullptr;
+    }
+    return &slots[jobId - 1];
+}
+
+int JobsList::getFinishedStatus(pid_t pid) const {
+    for (std::list<JobEntry>::const_reverse_iterator it = finishedJobs.rbegin(); it != finishedJobs.rend(); ++it) {
+        if (it->getPid() == pid) {
+            return it->getExitStatus();
         }
     }
-    return nullptr;
+    return -1;
 }
 
 JobsList::JobEntry *JobsList::getJobByPid(int jobPid) {
-    for(std::list<JobEntry>::reverse_iterator it = jobsList.rbegin(); it != jobsList.rend(); it++) {
-        if (it->getPid() == jobPid) {
-            return &(*it);
+    std::unordered_map<pid_t, int>::iterator it = pidIndex.find(jobPid);
+    if (it == pidIndex.end()) {
+        return nullptr;
+    }
+    return &slots[it->second - 1];
+}
+
+void CommandHash::checkPathEnv() {
+    const char* pathEnv = getenv("PATH");
+    std::string current = (pathEnv == nullptr) ? "" : pathEnv;
+    if (current != cachedPathEnv) { // every cached path may now be shadowed
+        table.clear();
+        cachedPathEnv = current;
+    }
+}
+
+std::string CommandHash::searchPath(const std::string& name, const std::string& pathEnv, bool* cacheable) {
+    *cacheable = true;
+    size_t start = 0;
+    while (start <= pathEnv.length()) {
+        size_t end = pathEnv.find(':', start);
+        if (end == string::npos) {
+            end = pathEnv.length();
+        }
+        std::string dir = pathEnv.substr(start, end - start);
+        if (dir.empty()) { // empty PATH entry means the current directory
+            dir = ".";
+        }
+        std::string candidate = dir + "/" + name;
+        struct stat st;
+        if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.c_str(), X_OK) == 0) {
+            *cacheable = (dir[0] == '/'); // a relative hit depends on the cwd
+            return candidate;
+        }
+        start = end + 1;
+    }
+    return "";
+}
+
+std::string CommandHash::lookup(const std::string& name) {
+    if (name.find('/') != string::npos) { // explicit path - nothing to resolve
+        return (access(name.c_str(), X_OK) == 0) ? name : "";
+    }
+    checkPathEnv();
+    std::unordered_map<std::string, HashEntry>::iterator it = table.find(name);
+    if (it != table.end()) {
+        if (access(it->second.getPath().c_str(), X_OK) == 0) {
+            it->second.hit();
+            return it->second.getPath();
+        }
+        table.erase(it); // cached binary disappeared - resolve again
+    }
+    bool cacheable = true;
+    std::string path = searchPath(name, cachedPathEnv, &cacheable);
+    if (!path.empty() && cacheable) {
+        HashEntry entry(path);
+        entry.hit();
+        table.insert(std::make_pair(name, entry));
+    }
+    return path;
+}
+
+void CommandHash::printTable() {
+    checkPathEnv();
+    if (table.empty()) {
+        std::cout << "smash: hash table empty" << std::endl;
+        return;
+    }
+    std::list<std::string> names;
+    for (const std::pair<const std::string, HashEntry>& p : table) {
+        names.push_back(p.first);
+    }
+    names.sort();
+    std::cout << "hits\tcommand" << std::endl;
+    for (const std::string& name : names) {
+        const HashEntry& e = table.at(name);
+        std::cout << std::setw(4) << e.getHits() << "\t" << e.getPath() << std::endl;
+    }
+}
+
+static double _bootSeconds() { //same clock as the start time in /proc/<pid>/stat
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+JobMonitor::JobMonitor() : procs(), foreign(), ticksPerSecond(sysconf(_SC_CLK_TCK)), pageKb(sysconf(_SC_PAGESIZE) / 1024) {}
+
+JobMonitor::~JobMonitor() {
+    for (const std::pair<const pid_t, ProcFiles>& p : procs) {
+        close(p.second.statFd);
+        if (p.second.ioFd != -1) {
+            close(p.second.ioFd);
+        }
+    }
+}
+
+void JobMonitor::drop(pid_t pid) {
+    std::unordered_map<pid_t, ProcFiles>::iterator it = procs.find(pid);
+    if (it == procs.end()) {
+        return;
+    }
+    close(it->second.statFd);
+    if (it->second.ioFd != -1) {
+        close(it->second.ioFd);
+    }
+    procs.erase(it);
+}
+
+// fields of /proc/<pid>/stat after the ")" closing the command name, which may itself contain spaces
+static bool _readProcStat(int fd, pid_t* pgrp, unsigned long long* ticks, int* threads, long* rssPages,
+                          unsigned long long* startTicks) {
+    char buf[1024];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) { //gone
+        return false;
+    }
+    buf[n] = '\0';
+    char* p = strrchr(buf, ')');
+    if (p == nullptr) {
+        return false;
+    }
+    p += 2; //field 3, state
+    unsigned long long fields[25] = {0};
+    for (int field = 3; field <= 24 && *p; ++field) {
+        fields[field] = (field == 3) ? 0 : strtoull(p, nullptr, 10);
+        p = strchr(p, ' ');
+        if (p == nullptr) {
+            break;
+        }
+        p++;
+    }
+    *pgrp = (pid_t)fields[5];
+    *ticks = fields[14] + fields[15]; //utime + stime
+    *threads = (int)fields[20];
+    *startTicks = fields[22];
+    *rssPages = (long)fields[24];
+    return true;
+}
+
+static void _readProcIo(int fd, unsigned long long* readBytes, unsigned long long* writeBytes) {
+    char buf[512];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return;
+    }
+    buf[n] = '\0';
+    const char* r = strstr(buf, "rchar: ");
+    const char* w = strstr(buf, "wchar: ");
+    *readBytes += r ? strtoull(r + 7, nullptr, 10) : 0;
+    *writeBytes += w ? strtoull(w + 7, nullptr, 10) : 0;
+}
+
+// the kernel has no index from a process group to its members, so new members are found by listing /proc;
+// a pid is only opened once, either kept (in a job's group) or remembered as foreign until it disappears
+void JobMonitor::sample(const std::unordered_set<pid_t>& groups, std::unordered_map<pid_t, JobSample>* samples) {
+    DIR* dir = opendir("/proc");
+    if (dir == nullptr) {
+        perror("smash error: opendir failed");
+        return;
+    }
+    std::unordered_set<pid_t> present;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+            continue;
+        }
+        pid_t pid = (pid_t)atoi(entry->d_name);
+        present.insert(pid);
+        if (procs.count(pid) != 0 || foreign.count(pid) != 0) {
+            continue;
+        }
+        std::string dirName = std::string("/proc/") + entry->d_name;
+        ProcFiles files;
+        files.statFd = open((dirName + "/stat").c_str(), O_RDONLY|O_CLOEXEC);
+        if (files.statFd == -1) { //exited meanwhile
+            continue;
+        }
+        pid_t pgrp = 0;
+        unsigned long long ticks = 0;
+        unsigned long long startTicks = 0;
+        int threads = 0;
+        long rssPages = 0;
+        if (!_readProcStat(files.statFd, &pgrp, &ticks, &threads, &rssPages, &startTicks) ||
+                groups.count(pgrp) == 0) {
+            close(files.statFd);
+            foreign.insert(pid);
+            continue;
+        }
+        files.ioFd = open((dirName + "/io").c_str(), O_RDONLY|O_CLOEXEC);
+        files.lastTicks = 0;
+        files.lastSeconds = 0;
+        procs[pid] = files;
+    }
+    closedir(dir);
+    for (std::unordered_set<pid_t>::iterator it = foreign.begin(); it != foreign.end(); ) {
+        it = present.count(*it) ? std::next(it) : foreign.erase(it);
+    }
+    double now = _bootSeconds();
+    std::vector<pid_t> gone;
+    for (std::pair<const pid_t, ProcFiles>& p : procs) {
+        pid_t pgrp = 0;
+        unsigned long long ticks = 0;
+        unsigned long long startTicks = 0;
+        int threads = 0;
+        long rssPages = 0;
+        if (!_readProcStat(p.second.statFd, &pgrp, &ticks, &threads, &rssPages, &startTicks)) {
+            gone.push_back(p.first);
+            continue;
+        }
+        if (groups.count(pgrp) == 0) { //never was, or left, a job's group
+            gone.push_back(p.first);
+            foreign.insert(p.first);
+            continue;
+        }
+        double since = p.second.lastSeconds ? p.second.lastSeconds : (double)startTicks / ticksPerSecond;
+        unsigned long long previous = p.second.lastSeconds ? p.second.lastTicks : 0;
+        JobSample& sample = (*samples)[pgrp];
+        sample.processes++;
+        sample.threads += threads;
+        sample.rssKb += rssPages * pageKb;
+        if (now > since) {
+            sample.cpuPercent += 100.0 * (ticks - previous) / ticksPerSecond / (now - since);
         }
+        if (p.second.ioFd != -1) {
+            _readProcIo(p.second.ioFd, &sample.readBytes, &sample.writeBytes);
+        }
+        p.second.lastTicks = ticks;
+        p.second.lastSeconds = now;
+    }
+    for (pid_t pid : gone) {
+        drop(pid);
     }
-    return nullptr;
 }
 
-JobsList::JobEntry::JobEntry(pid_t pid, int jobId, std::string cmd_line, bool stopped, time_t time) :
-        pid(pid), jobId(jobId), cmd_line(cmd_line), stopped(stopped), insertionTime(time) {
+JobsList::JobEntry::JobEntry() : pid(0), jobId(0), cmd_line(), stopped(false), queued(false), insertionTime(0), exitStatus(-1),
+        prevStopped(0), nextStopped(0), pidfd(-1), usage(), limits(), cgroup(), oomKilled(false) {}
+
+JobsList::JobEntry::JobEntry(pid_t pid, int jobId, std::string cmd_line, time_t time) :
+        pid(pid), jobId(jobId), cmd_line(cmd_line), stopped(false), queued(false), insertionTime(time), exitStatus(-1),
+        prevStopped(0), nextStopped(0), pidfd(-1), usage(), limits(), cgroup(), oomKilled(false) {}
+        //stopped is only set through JobsList::linkStopped
+
+std::string JobsList::JobEntry::describeExit() const {
+    if (exitStatus == -1) {
+        return "running";
+    }
+    std::string reason = limits.killReason(exitStatus, usage, oomKilled);
+    if (!reason.empty()) {
+        return "killed by its " + reason;
+    }
+    if (WIFSIGNALED(exitStatus)) {
+        return "killed by signal " + std::to_string(WTERMSIG(exitStatus));
+    }
+    return "done, exit status " + std::to_string(WEXITSTATUS(exitStatus));
 }
 
 double JobsList::JobEntry::getSecondsElapsed() const {
@@ -705,10 +3663,6 @@ void JobsList::setFgCommand(pid_t pid, const char *cmd_line) {
     fgPid = pid;
 }
 
-bool operator==(const JobsList::JobEntry & j1, const JobsList::JobEntry & j2) {
-    return j1.getJobId() == j2.getJobId();
-}
-
 void JobsList::JobEntry::resetSecondsElapsed() {
     time_t currentTime = time(nullptr);
     if (currentTime == -1) {
@@ -716,30 +3670,157 @@ void JobsList::JobEntry::resetSecondsElapsed() {
     } else { insertionTime = currentTime; }
 }
 
+bool JobsList::waitForeground(pid_t pgid) {
+    ShellStats::Timer timer(SmallShell::getInstance().getStatsPtr(), ShellStats::PHASE_WAIT);
+    if (EventLoop::getInstance().isActive()) { //keep serving signals and timers while waiting
+        return EventLoop::getInstance().waitForeground(pgid);
+    }
+    int status = 0; //nested in a forked child - just block
+    while (true) {
+        struct rusage usage;
+        pid_t pid = wait4(-pgid, &status, WUNTRACED, &usage);
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ECHILD) {
+                return true;
+            }
+            perror("smash error: wait4 failed");
+            return false;
+        }
+        if (WIFSTOPPED(status)) {
+            return false;
+        }
+        noteReaped(pid, pgid, status, usage);
+    }
+}
+
 void JobsList::removeJob(pid_t pid) {
-    jobsList.remove(*(getJobByPid(pid)));
+    JobEntry* j = getJobByPid(pid);
+    if (j == nullptr) {
+        return;
+    }
+    publish(*j, SMASH_EVENT_FINISHED, j->getExitStatus());
+    pidIndex.erase(pid);
+    clearSlot(j);
+}
+
+void JobsList::clearSlot(JobEntry* j) {
+    unlinkStopped(j);
+    if (j->pidfd != -1) {
+        close(j->pidfd);
+    }
+    int jobId = j->jobId;
+    *j = JobEntry();
+    jobsCount--;
+    if (publisher) {
+        publisher->clearJob(jobId, jobsCount);
+    }
+    while (!slots.empty() && slots.back().getJobId() == 0) { //keeps max id + 1 == size + 1
+        slots.pop_back();
+    }
 }
 
-SmallShell::SmallShell() : redirectionCommand(nullptr), forkCommand(false), prompt(nullptr), lastPwd(nullptr), smashPid(0) {
+SmallShell::SmallShell() : redirectionCommand(nullptr), timeoutDuration(0), timeoutGrace(0), forkCommand(false), prompt(nullptr), lastPwd(nullptr), smashPid(0),
+        traceExec(false), useSpawn(true), pipeSize(0), execCounts(localExecCounts), localExecCounts(), lastStatus(0),
+        lastBackgroundPid(0), jobsLimit(0), executeDepth(0), startingJobId(0), limits(), limitsCgroup(),
+        cgroupCount(0), placementPolicy(PLACE_OFF), placedJobs(0), numaNodes(), pinnedCpus(), pinned(false), savedCpus(),
+        stats(), jobsPublisher(), statsJsonPath(),
+        outputBuffer(nullptr), originalCoutBuffer(nullptr) {
     smashPid = getpid();
+    void* counts = mmap(nullptr, sizeof(localExecCounts), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (counts != MAP_FAILED) {
+        execCounts = (unsigned long*)counts;
+    }
+    const char* trace = getenv("SMASH_TRACE");
+    traceExec = (trace != nullptr && *trace != '\0' && strcmp(trace, "0") != 0);
+    const char* spawn = getenv("SMASH_SPAWN");
+    useSpawn = (spawn == nullptr || strcmp(spawn, "0") != 0);
+    const char* pipeSizeEnv = getenv("SMASH_PIPE_SIZE");
+    if (pipeSizeEnv != nullptr) {
+        pipeSize = atoi(pipeSizeEnv);
+    }
+    const char* placement = getenv("SMASH_PLACEMENT");
+    if (placement != nullptr && strcmp(placement, "cores") == 0) {
+        placementPolicy = PLACE_CORES;
+    } else if (placement != nullptr && strcmp(placement, "nodes") == 0) {
+        placementPolicy = PLACE_NODES;
+    }
+    const char* statsEnv = getenv("SMASH_STATS");
+    const char* statsJson = getenv("SMASH_STATS_JSON");
+    if (statsJson != nullptr && *statsJson != '\0') {
+        statsJsonPath = statsJson;
+    }
+    stats.setEnabled(!statsJsonPath.empty() || (statsEnv != nullptr && *statsEnv != '\0' && strcmp(statsEnv, "0") != 0));
+    const char* shm = getenv("SMASH_SHM");
+    if (shm != nullptr && *shm != '\0' && strcmp(shm, "0") != 0 && jobsPublisher.open(smashPid)) {
+        jobsList.setPublisher(&jobsPublisher);
+    }
 }
 
 SmallShell::~SmallShell() {
+    if (!statsJsonPath.empty() && getpid() == smashPid) { //forked children exit through here too
+        int fd = open(statsJsonPath.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+        if (fd == -1) {
+            perror("smash error: open failed");
+        } else {
+            _writeAll(fd, stats.toJson());
+            close(fd);
+        }
+    }
+    if (outputBuffer) {
+        outputBuffer->flush();
+        std::cout.rdbuf(originalCoutBuffer);
+        delete outputBuffer;
+    }
     delete(redirectionCommand);
 	free(prompt);
 	free(lastPwd);
 }
 
+// cat, wc and fgrep run inside smash only when every operand is a regular file, which can't block
+// it, and no job was asked for with "&"; otherwise they're forked, which still skips the exec.
+// nullptr if the line needs the real program
+template <class FileBuiltin>
+static Command* _fileBuiltin(const char* cmd_line, const std::string& cmd_s, bool* forkCommand) {
+    FileBuiltin* cmd = new FileBuiltin(cmd_s.c_str());
+    if (!cmd->isSupported()) {
+        delete cmd;
+        return nullptr;
+    }
+    *forkCommand = !cmd->isInProcess() || _isBackgroundComamnd(cmd_line);
+    return cmd;
+}
+
 Command * SmallShell::CreateCommand(const char* cmd_line) {
+    ShellStats::Timer timer(&stats, ShellStats::PHASE_PARSE);
     std::string cmd_s = (_trim(string(cmd_line)));
-    size_t special_index = cmd_s.find_first_of('>');
+    std::string prefix = cmd_s.substr(0, cmd_s.find_first_of(WHITESPACE+'&'));
+    if (prefix == "timeout") { //prefixes hand the rest, redirection and pipes included, back to executeCommand
+        return new TimeoutCommand(cmd_line);
+    }
+    if (prefix == "time") {
+        return new TimeCommand(cmd_line);
+    }
+    if (prefix == "limit") {
+        return new LimitCommand(cmd_line);
+    }
+    if (prefix == "pin") {
+        return new PinCommand(cmd_line);
+    }
+    if (_findUnquoted(cmd_s, "|{") != string::npos) {   //fan-out pipeline, its consumers redirect on their own
+        forkCommand = true;
+        return new PipeCommand(cmd_line);
+    }
+    size_t special_index = _findUnquoted(cmd_s, ">");
     if (special_index != string::npos) {   //redirection
         RedirectionCommand* r = new RedirectionCommand(cmd_line);
         setRedirectionCommand(r);
         cmd_s = cmd_s.substr(0, special_index);
     }
-    special_index = cmd_s.find_first_of('|');
-    if (special_index != string::npos) {   //pipe
+    special_index = _findUnquoted(cmd_s, "|");
+    if (special_index != string::npos) {   //pipe - launched stage by stage, not forked as a whole
         forkCommand = true;
         return new PipeCommand(cmd_line);
     }
@@ -748,9 +3829,6 @@ Command * SmallShell::CreateCommand(const char* cmd_line) {
     if (first_arg.length() == 0) { return nullptr; } //if nothing or only whitespace is entered
     if (first_arg_length != string::npos) { //if args
         first_arg = first_arg.substr(0, first_arg_length);
-    }
-    if (first_arg == "timeout") {
-        return new TimeoutCommand(cmd_line);
     }
 	if (first_arg == "chprompt") {
 		return new ChangePromptCommand(cmd_s.c_str(), getPromptPtr());
@@ -765,7 +3843,22 @@ Command * SmallShell::CreateCommand(const char* cmd_line) {
 		return new ChangeDirCommand(cmd_s.c_str(), getLastPwdPtr());
 	}
 	if (first_arg == "jobs") {
-		return new JobsCommand(cmd_s.c_str(), getJobsListPtr());
+		return new JobsCommand(cmd_s.c_str(), getJobsListPtr(), getJobMonitorPtr());
+	}
+	if (first_arg == "stats") {
+		return new StatsCommand(cmd_s.c_str());
+	}
+	if (first_arg == "jobslimit") {
+		return new JobsLimitCommand(cmd_s.c_str());
+	}
+	if (first_arg == "placement") {
+		return new PlacementCommand(cmd_s.c_str());
+	}
+	if (first_arg == "parallel") {
+		return new ParallelCommand(cmd_s.c_str(), getJobsListPtr());
+	}
+	if (first_arg == "jtop") {
+		return new JobsTopCommand(cmd_s.c_str(), getJobsListPtr(), getJobMonitorPtr());
 	}
 	if (first_arg == "kill") {
 		return new KillCommand(cmd_s.c_str(), getJobsListPtr());
@@ -776,9 +3869,23 @@ Command * SmallShell::CreateCommand(const char* cmd_line) {
 	if (first_arg == "bg") {
 		return new BackgroundCommand(cmd_s.c_str(), getJobsListPtr());
 	}
+	if (first_arg == "hash") {
+		return new HashCommand(cmd_s.c_str(), getCommandHashPtr());
+	}
 	if (first_arg == "quit") {
 		return new QuitCommand(cmd_s.c_str(), getJobsListPtr());
 	}
+	Command* fileBuiltin = nullptr;
+	if (first_arg == "fgrep") {
+		fileBuiltin = _fileBuiltin<FgrepCommand>(cmd_line, cmd_s, &forkCommand);
+	} else if (first_arg == "wc") {
+		fileBuiltin = _fileBuiltin<WcCommand>(cmd_line, cmd_s, &forkCommand);
+	} else if (first_arg == "cat") {
+		fileBuiltin = _fileBuiltin<CatCommand>(cmd_line, cmd_s, &forkCommand);
+	}
+	if (fileBuiltin) {
+		return fileBuiltin;
+	}
     forkCommand = true;
     if (first_arg == "cp") {
 
@@ -787,15 +3894,248 @@ Command * SmallShell::CreateCommand(const char* cmd_line) {
     return new ExternalCommand(cmd_s.c_str());
 }
 
+// shell-style exit code of a wait status, -1 (never reaped by us) counts as success
+static int _exitCode(int status) {
+    if (status == -1) {
+        return 0;
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+void SmallShell::setBatchMode() {
+    if (outputBuffer) {
+        return;
+    }
+    std::cout.flush();
+    outputBuffer = new OutputBuffer(1, 64 * 1024);
+    originalCoutBuffer = std::cout.rdbuf(outputBuffer);
+}
+
+void SmallShell::flushOutput() {
+    if (outputBuffer) {
+        outputBuffer->flush();
+    } else {
+        std::cout.flush();
+    }
+}
+
 void SmallShell::executeCommand(const char *cmd_line) {
+    long long start = stats.start();
+    executeDepth++;
+    runCommand(cmd_line);
+    executeDepth--;
+    if (start != 0) { //prefixed commands count under both names, but the line is one command
+        stats.recordCommand(cmd_line, start);
+        if (executeDepth == 0) {
+            stats.record(ShellStats::PHASE_COMMAND, start);
+        }
+    }
+}
+
+bool SmallShell::startQueuedJob(int jobId) {
+    JobsList::JobEntry* j = jobsList.getJobById(jobId);
+    if (j == nullptr || !j->isQueued()) {
+        return false;
+    }
+    std::string commandLine = j->getCommandLine();
+    startingJobId = jobId;
+    executeCommand(commandLine.c_str());
+    if (startingJobId == jobId) { //nothing was launched, the error was already printed
+        startingJobId = 0;
+        jobsList.cancelQueuedJob(jobId);
+        return false;
+    }
+    return true;
+}
+
+// the per-command state (redirection, timeout, fg job) belongs to the command being executed,
+// so queued jobs are only started while no command is
+void SmallShell::startQueuedJobs() {
+    if (executeDepth != 0 || jobsList.getQueuedCount() == 0) {
+        return;
+    }
+    jobsList.removeFinishedJobs();
+    while (jobsList.getQueuedCount() > 0 && (jobsLimit == 0 || jobsList.getRunningCount() < jobsLimit)) {
+        startQueuedJob(jobsList.getNextQueuedId());
+    }
+}
+
+// both sides apply the rlimits: the child so they hold before exec, smash so they can be read back at once
+void SmallShell::applyLimits(pid_t pid) {
+    if (!limits.isSet()) {
+        return;
+    }
+    if (pid == 0 && !limitsCgroup.empty()) {
+        ResourceLimits::joinCgroup(limitsCgroup);
+    }
+    limits.apply(pid);
+}
+
+void SmallShell::clearLimits() {
+    if (!limitsCgroup.empty()) { //not handed to a job, so whatever ran in it is gone
+        rmdir(limitsCgroup.c_str());
+        limitsCgroup.clear();
+    }
+    limits = ResourceLimits();
+}
+
+const std::vector<cpu_set_t>& SmallShell::getNumaNodes() {
+    if (!numaNodes.empty()) {
+        return numaNodes;
+    }
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir) {
+        std::vector<std::pair<int, cpu_set_t>> nodes;
+        for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+            char* end = nullptr;
+            if (strncmp(entry->d_name, "node", 4) != 0 || !isdigit((unsigned char)entry->d_name[4])) {
+                continue;
+            }
+            int node = (int)strtol(entry->d_name + 4, &end, 10);
+            std::string list = _readFile(std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+            cpu_set_t cpus;
+            if (*end == '\0' && _parseCpuList(_trim(list).c_str(), &cpus) && CPU_COUNT(&cpus) > 0) {
+                nodes.push_back(std::make_pair(node, cpus));
+            }
+        }
+        closedir(dir);
+        std::sort(nodes.begin(), nodes.end(), [](const std::pair<int, cpu_set_t>& a,
+                                                 const std::pair<int, cpu_set_t>& b) { return a.first < b.first; });
+        for (const std::pair<int, cpu_set_t>& n : nodes) {
+            numaNodes.push_back(n.second);
+        }
+    }
+    if (numaNodes.empty()) { //no NUMA support: one node with every cpu
+        cpu_set_t all;
+        CPU_ZERO(&all);
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, &all);
+        }
+        numaNodes.push_back(all);
+    }
+    return numaNodes;
+}
+
+// posix_spawn has no hook to run code in the child before exec, so the launch itself runs on
+// the narrowed set: spawned and forked children alike inherit it and never run anywhere else
+bool SmallShell::beginPlacement(bool background) {
+    if (!pinned && (!background || placementPolicy == PLACE_OFF)) {
+        return false;
+    }
+    if (sched_getaffinity(0, sizeof(savedCpus), &savedCpus) == -1) {
+        perror("smash error: sched_getaffinity failed");
+        pinned = false;
+        return false;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (pinned) {
+        CPU_AND(&cpus, &pinnedCpus, &savedCpus);
+        pinned = false;
+    } else if (placementPolicy == PLACE_CORES) { //the next cpu smash itself may use
+        int index = (int)(placedJobs++ % CPU_COUNT(&savedCpus));
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &savedCpus) && index-- == 0) {
+                CPU_SET(cpu, &cpus);
+                break;
+            }
+        }
+    } else { //the next node with a cpu smash may use
+        std::vector<cpu_set_t> usable;
+        for (const cpu_set_t& node : getNumaNodes()) {
+            cpu_set_t both;
+            CPU_AND(&both, &node, &savedCpus);
+            if (CPU_COUNT(&both) > 0) {
+                usable.push_back(both);
+            }
+        }
+        if (!usable.empty()) {
+            cpus = usable[placedJobs++ % usable.size()];
+        }
+    }
+    if (CPU_COUNT(&cpus) == 0 || CPU_EQUAL(&cpus, &savedCpus)) {
+        return false;
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+        perror("smash error: sched_setaffinity failed");
+        return false;
+    }
+    return true;
+}
+
+void SmallShell::endPlacement() {
+    if (sched_setaffinity(0, sizeof(savedCpus), &savedCpus) == -1) {
+        perror("smash error: sched_setaffinity failed");
+    }
+}
+
+void SmallShell::runCommand(const char *cmd_line) {
     Command* cmd = CreateCommand(cmd_line);
     if (!cmd) { return; } //if nothing or only whitespace is entered
     jobsList.removeFinishedJobs();
-    if (forkCommand) {
+    bool launches = forkCommand || dynamic_cast<TimeoutCommand*>(cmd) != nullptr ||
+                    dynamic_cast<LimitCommand*>(cmd) != nullptr || dynamic_cast<PinCommand*>(cmd) != nullptr;
+    if (executeDepth == 1 && startingJobId == 0 && jobsLimit > 0 && launches && _isBackgroundComamnd(cmd_line) &&
+            (jobsList.getRunningCount() >= jobsLimit || jobsList.getQueuedCount() > 0)) { //FIFO behind the queue
+        jobsList.queueJob(_trim(string(cmd_line)));
         forkCommand = false;
-	   	pid_t pid = fork();
+        setTimeoutDuration(0);
+        clearLimits();
+        pinned = false;
+        clearRedirectionCommand();
+        lastStatus = 0;
+        delete cmd;
+        return;
+    }
+    jobsList.clearUnclaimedExits(); //only exits of what this command launches can still be claimed
+    if (forkCommand) {
+        // pipelines start their stages themselves; external commands need no work in the child,
+        // so they skip fork() and its page-table copy
+        PipeCommand* pipeline = dynamic_cast<PipeCommand*>(cmd);
+        // limits are set in the child between fork and exec, which posix_spawn has no hook for
+        ExternalCommand* external = (useSpawn && !limits.isSet()) ? dynamic_cast<ExternalCommand*>(cmd) : nullptr;
+        pid_t pid = 0;
+        long long launchStart = stats.start();
+        flushOutput(); //children write to the same stdout, and a forked one would inherit our buffer
+        if (limits.isSet()) {
+            limitsCgroup = limits.createCgroup("smash-" + std::to_string(smashPid) + "-" +
+                                               std::to_string(++cgroupCount));
+        }
+        bool placed = beginPlacement(_isBackgroundComamnd(cmd_line));
+        if (pipeline) {
+            pid = pipeline->launch(redirectionCommand);
+        } else if (external) {
+            pid = spawnExternal(external);
+        } else {
+            pid = fork();
+        }
+        forkCommand = false; //pipeline stages went through CreateCommand too
+        if (placed && (pid != 0 || pipeline || external)) { //not in a forked child, it keeps the narrowed set
+            endPlacement();
+        }
+        if (pid > 0) {
+            stats.record(ShellStats::PHASE_LAUNCH, launchStart);
+        }
+        if (pid == 0 && (pipeline || external)) { //redirection target could not be opened, nothing was launched
+            setTimeoutDuration(0);
+            clearLimits();
+            clearRedirectionCommand();
+            jobsList.clearFgCommand();
+            delete cmd;
+            return;
+        }
 		if (pid == -1) {
-			perror("smash error: fork failed");
+            if (!pipeline && !external) { //the others report their own failure
+                perror("smash error: fork failed");
+            }
+            if (external) { //what bash exits with when it can't run a program
+                lastStatus = (errno == ENOENT) ? 127 : 126;
+            }
+            setTimeoutDuration(0);
+            clearLimits();
             clearRedirectionCommand();
             jobsList.clearFgCommand();
             delete cmd;
@@ -803,6 +4143,7 @@ void SmallShell::executeCommand(const char *cmd_line) {
 		}
 
 		if (pid == 0) { //child
+            EventLoop::resetChildSignals();
 			if (setpgrp() == -1) {
                 perror("smash error: setpgrp failed");
                 clearRedirectionCommand();
@@ -810,21 +4151,34 @@ void SmallShell::executeCommand(const char *cmd_line) {
                 delete cmd;
                 exit(0);
 			}
+            applyLimits(0);
+            lastStatus = 0; //a forked builtin exits with the status it sets, like an in-process one
             if (redirectionCommand) {
                 if (redirectionCommand->prepare()) { cmd->execute(); }
             } else { cmd->execute(); }
-			exit(0);
+			exit(lastStatus);
 		} else { //father
+            if (!pipeline && !external) { //forked: also from here, or waiting on the group could beat the child's setpgrp()
+                setpgid(pid, pid);
+                applyLimits(pid); //stages got theirs in launchStage
+            }
 		    if (getTimeoutDuration() > 0) {
-		        TimeoutEntry t(pid, getTimeoutDuration(), getTimeoutOriginalCommandLine());
-		        timedCommands.push_back(t);
-		        manageAlarm();
+		        timeouts.schedule(pid, timeoutDuration, timeoutGrace, getTimeoutOriginalCommandLine());
 		    }
+			lastStatus = 0;
 			if (_isBackgroundComamnd(cmd_line)) { //background
-                if (getTimeoutDuration() > 0) {
+                if (startingJobId != 0) {
+                    jobsList.startQueuedJob(startingJobId, pid);
+                    startingJobId = 0;
+                } else if (getTimeoutDuration() > 0) {
                     jobsList.addJob(getTimeoutOriginalCommandLine(), pid);
                 } else {
                     jobsList.addJob(cmd_line, pid);
+                }
+                lastBackgroundPid = pid;
+                if (limits.isSet()) { //the job owns the cgroup from now on
+                    jobsList.setJobLimits(pid, limits, limitsCgroup);
+                    limitsCgroup.clear();
                 }
 			} else { //foreground
                 if (getTimeoutDuration() > 0) {
@@ -832,32 +4186,55 @@ void SmallShell::executeCommand(const char *cmd_line) {
                 } else {
                     jobsList.setFgCommand(pid, cmd_line);
                 }
-			    if (waitpid(pid, nullptr, WUNTRACED) == -1) {
-                    perror("smash error: waitpid failed");
-                    clearRedirectionCommand();
-                    jobsList.clearFgCommand();
-                    delete cmd;
-                    return;
+                jobsList.setFgStatusPid(pipeline ? pipeline->getLastStagePid() : pid);
+			    if (jobsList.waitForeground(pid)) { //finished early, its timer must not fire
+                    timeouts.cancel(pid);
+                    lastStatus = _exitCode(jobsList.getFgStatus());
+                    std::string reason = limits.killReason(jobsList.getFgStatus(), jobsList.getFgUsage(),
+                                                           ResourceLimits::wasOomKilled(limitsCgroup));
+                    if (!reason.empty()) {
+                        std::cerr << "smash: " << jobsList.getFgCommandLine() << " was killed by its " << reason <<
+                                  std::endl;
+                    }
+                } else { //stopped by ctrl-Z, or killed by ctrl-C
+                    lastStatus = 128 + (jobsList.getJobByPid(pid) ? SIGTSTP : SIGKILL);
+                    if (limits.isSet() && jobsList.getJobByPid(pid)) {
+                        jobsList.setJobLimits(pid, limits, limitsCgroup);
+                        limitsCgroup.clear();
+                    }
                 }
 			}
 		}
 	} else { //no fork
+        lastStatus = 0; //a nested command (timeout) may set its own status while executing
         if (redirectionCommand) {
             if (redirectionCommand->prepare()) { cmd->execute(); }
             redirectionCommand->cleanup();
-        } else { cmd->execute(); }
-        if (getTimeoutDuration() > 0) {
-            TimeoutEntry t(0, getTimeoutDuration(), getTimeoutOriginalCommandLine());
-            timedCommands.push_back(t);
-            manageAlarm();
-        }
+        } else { cmd->execute(); } //already done, a timeout on it has nothing left to kill
     }
     setTimeoutDuration(0);
+    clearLimits();
+    pinned = false; //prefixed a builtin, nothing was launched
     clearRedirectionCommand();
     jobsList.clearFgCommand();
     delete cmd;
 }
 
+pid_t SmallShell::spawnExternal(ExternalCommand* cmd) { //0 if nothing was launched
+    int stdoutFd = -1;
+    if (redirectionCommand) {
+        stdoutFd = redirectionCommand->openTarget();
+        if (stdoutFd == -1) {
+            return 0;
+        }
+    }
+    pid_t pid = cmd->spawn(-1, stdoutFd, -1, 0);
+    if (stdoutFd != -1 && close(stdoutFd) == -1) {
+        perror("smash error: close failed");
+    }
+    return pid;
+}
+
 void SmallShell::setRedirectionCommand(RedirectionCommand* redirectionCommand) {
     this->redirectionCommand = redirectionCommand;
 }
@@ -867,49 +4244,142 @@ void SmallShell::clearRedirectionCommand() {
     redirectionCommand =  nullptr;
 }
 
-bool SmallShell::TimeoutEntry::sortByTimeToAlarm::operator()(const SmallShell::TimeoutEntry &t1,
-                                                             const SmallShell::TimeoutEntry &t2) const {
-    time_t currentTime = time(nullptr);
-    if (currentTime == -1) {
-        perror("smash error: time failed");
+TimeoutQueue::TimeoutEntry::TimeoutEntry(pid_t pid, long long deadline, long long graceNs, unsigned long id,
+                                         std::string commandLine) :
+        pid(pid), deadline(deadline), graceNs(graceNs), terminated(false), id(id), commandLine(commandLine) {}
+
+TimeoutQueue::TimeoutQueue() : heap(), live(), nextId(1), timerFd(-1), ownerPid(getpid()) {
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (timerFd == -1) {
+        perror("smash error: timerfd_create failed");
     }
-    double t1TimeToAlarm = t1.timeoutDuration - (difftime(currentTime,t1.timestamp));
-    double t2TimeToAlarm = t2.timeoutDuration - (difftime(currentTime,t2.timestamp));
-    return (t1TimeToAlarm <= t2TimeToAlarm);
 }
 
-void SmallShell::manageAlarm() {  //sort by timeout duration - ( current time - timestamp )
-    TimeoutEntry& t = timedCommands.back();
-    timedCommands.sort(TimeoutEntry::sortByTimeToAlarm());
-    if (timedCommands.size() == 1 || &t == &timedCommands.front()) {
-        alarm(timeoutDuration);
+TimeoutQueue::~TimeoutQueue() {
+    if (timerFd != -1) {
+        close(timerFd);
     }
 }
 
-SmallShell::TimeoutEntry SmallShell::popTimedoutEntry() {
-    TimeoutEntry t(timedCommands.front());
-    timedCommands.pop_front();
-    return t;
+bool TimeoutQueue::acknowledge() {
+    unsigned long long expirations = 0;
+    return read(timerFd, &expirations, sizeof(expirations)) == sizeof(expirations) && expirations > 0;
 }
 
-SmallShell::TimeoutEntry::TimeoutEntry(pid_t pid, int timeoutDuration, std::string commandLine)  : pid(pid), timeoutDuration(timeoutDuration), commandLine(commandLine) {
-    timestamp = time(nullptr);
-    if (timestamp == -1) {
-        perror("smash error: time failed");
+long long TimeoutQueue::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+bool TimeoutQueue::isLive(const TimeoutEntry& t) const {
+    std::unordered_map<pid_t, unsigned long>::const_iterator it = live.find(t.pid);
+    return it != live.end() && it->second == t.id;
+}
+
+void TimeoutQueue::push(const TimeoutEntry& t) {
+    heap.push_back(t);
+    std::push_heap(heap.begin(), heap.end(), TimeoutEntry::laterDeadline());
+}
+
+void TimeoutQueue::dropCancelled() {
+    if (heap.size() > 2 * live.size() + 64) { //mostly cancelled entries - rebuild in O(n)
+        std::vector<TimeoutEntry> kept;
+        for (const TimeoutEntry& t : heap) {
+            if (isLive(t)) {
+                kept.push_back(t);
+            }
+        }
+        heap.swap(kept);
+        std::make_heap(heap.begin(), heap.end(), TimeoutEntry::laterDeadline());
+    }
+    while (!heap.empty() && !isLive(heap.front())) {
+        std::pop_heap(heap.begin(), heap.end(), TimeoutEntry::laterDeadline());
+        heap.pop_back();
     }
 }
 
-void SmallShell::setNewAlarm() const {
-    if (!timedCommands.empty()) {
-        timedCommands.front().setAlarm();
+void TimeoutQueue::arm() {
+    if (timerFd == -1 || getpid() != ownerPid) {
+        return;
+    }
+    dropCancelled();
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its)); //all zero disarms
+    if (!heap.empty()) {
+        its.it_value.tv_sec = heap.front().deadline / 1000000000LL;
+        its.it_value.tv_nsec = heap.front().deadline % 1000000000LL;
+    }
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, nullptr) == -1) {
+        perror("smash error: timerfd_settime failed");
     }
 }
 
-void SmallShell::TimeoutEntry::setAlarm() const {
-    time_t currentTime = time(nullptr);
-    if (currentTime == -1) {
-        perror("smash error: time failed");
+void TimeoutQueue::schedule(pid_t pid, double seconds, double graceSeconds, const std::string& commandLine) {
+    TimeoutEntry t(pid, now() + (long long)(seconds * 1e9), (long long)(graceSeconds * 1e9), nextId++, commandLine);
+    live[pid] = t.id;
+    bool earliest = heap.empty() || t.deadline < heap.front().deadline;
+    push(t);
+    if (earliest) {
+        arm();
+    }
+}
+
+void TimeoutQueue::cancel(pid_t pid) {
+    if (live.erase(pid) == 0) {
+        return;
+    }
+    if (!heap.empty() && heap.front().pid == pid) { //don't wake up for it
+        arm();
+    }
+}
+
+void TimeoutQueue::expire() {
+    long long currentTime = now();
+    dropCancelled();
+    while (!heap.empty() && heap.front().deadline <= currentTime) {
+        std::pop_heap(heap.begin(), heap.end(), TimeoutEntry::laterDeadline());
+        TimeoutEntry t = heap.back();
+        heap.pop_back();
+        if (isLive(t)) {
+            bool terminate = (t.graceNs > 0 && !t.terminated);
+            if (kill((-1) * t.pid, terminate ? SIGTERM : SIGKILL) == -1) { //signal to GROUP
+                if (errno != ESRCH) { //unexpected error
+                    perror("smash error: kill failed");
+                }
+                live.erase(t.pid);
+            } else if (terminate) { //SIGKILL follows if it is still around after the grace period
+                std::cout << "smash: " << t.getCommandLine() << " timed out!" << endl;
+                SmallShell::getInstance().getJobsListPtr()->noteTimedOut(t.pid, t.getCommandLine());
+                t.terminated = true;
+                t.deadline = currentTime + t.graceNs;
+                push(t);
+            } else {
+                if (!t.terminated) {
+                    std::cout << "smash: " << t.getCommandLine() << " timed out!" << endl;
+                    SmallShell::getInstance().getJobsListPtr()->noteTimedOut(t.pid, t.getCommandLine());
+                }
+                live.erase(t.pid);
+            }
+        }
+        dropCancelled();
+    }
+    arm();
+}
+
+void SmallShell::noteExec(bool direct, const std::string& commandLine) {
+    __atomic_fetch_add(&execCounts[direct ? 0 : 1], 1, __ATOMIC_RELAXED);
+    if (traceExec) {
+        std::cerr << "smash: exec (" << (direct ? "direct" : "bash") << ", direct=" << getDirectExecCount() <<
+                  " bash=" << getBashExecCount() << "): " << commandLine << std::endl;
     }
-    alarm(int((timeoutDuration - (difftime(currentTime,timestamp)))));
 }
 
+void SmallShell::noteExecFallback(const std::string& commandLine) {
+    __atomic_fetch_sub(&execCounts[0], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&execCounts[1], 1, __ATOMIC_RELAXED);
+    if (traceExec) {
+        std::cerr << "smash: exec (bash, direct exec failed, direct=" << getDirectExecCount() << " bash=" <<
+                  getBashExecCount() << "): " << commandLine << std::endl;
+    }
+}
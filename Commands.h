@@ -3,23 +3,46 @@
 
 #include <string>
 #include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <csignal>
+#include <ctime>
+#include <streambuf>
+#include <functional>
+#include <sys/resource.h>
+#include <sched.h>
 
-#define COMMAND_ARGS_MAX_LENGTH (200) // pdf says 80 characters
-#define COMMAND_MAX_ARGS (20)
-#define BUFFER_SIZE (4096)
+#define COMMAND_INLINE_ARGS (16) // argv slots kept inside the Command, more spill to the heap
+#define COMMAND_INLINE_ARENA (512) // token bytes kept inside the Command, longer lines spill to the heap
+#define COPY_BUFFER_SIZE (1 << 20) // read/write fallback of cp
+#define PARALLEL_COPY_THRESHOLD (256LL << 20) // cp splits files at least this big across workers
+#define PARALLEL_COPY_MAX_WORKERS (8) // default worker count cap when cp picks parallel mode itself
+#define FINISHED_JOBS_HISTORY (64) // finished background jobs kept for "jobs -v"
+#define STATS_BUCKETS (8 * 62) // latency histogram: 8 buckets per power of two of nanoseconds
 
 class Command {
 	const std::string cmd_line;
 	int argc;
-	char* argv[COMMAND_MAX_ARGS+1];
+	char** argv; // nullptr terminated, the strings live in the arena
+	char* body; // cmd_line without the background sign and surrounding whitespace, also in the arena
+	char* inlineArgv[COMMAND_INLINE_ARGS+1];
+	char inlineArena[COMMAND_INLINE_ARENA];
+	std::vector<char*> spilledArgv;
+	std::vector<char> spilledArena;
+	void parse();
 public:
     explicit Command(const char* cmd_line);
-    virtual ~Command();
+    Command(const Command&) = delete; // argv points into the object itself
+    Command& operator=(const Command&) = delete;
+    virtual ~Command() = default;
     virtual void execute() = 0;
     std::string getCommandLine() const { return cmd_line; }
 protected:
     int getArgCount() const { return argc; }
     const char* getArg(int argNumber) const { return argv[argNumber]; }
+    char** getArgs() { return argv; }
+    char* getBody() { return body; }
 };
 
 class BuiltInCommand : public Command {
@@ -29,20 +52,35 @@ class BuiltInCommand : public Command {
 };
 
 class ExternalCommand : public Command {
+    bool bashRequired; // true if the line uses syntax only bash can interpret
+    std::string execPath; // absolute path of the program when !bashRequired
+    void execBash();
  public:
   explicit ExternalCommand(const char* cmd_line);
   ~ExternalCommand() override = default;
   void execute() override;
+  // launch without forking smash, -1 fds are inherited; pgroup 0 starts a new group; -1 on failure
+  pid_t spawn(int stdinFd, int stdoutFd, int stderrFd, pid_t pgroup);
+  bool isBashRequired() const { return bashRequired; }
 };
 
+class RedirectionCommand;
+
 class PipeCommand : public Command {
-    bool outputToStderr;
-    std::string lCommandLine;
-    std::string rCommandLine;
+    std::vector<std::string> stageLines;
+    std::vector<bool> stderrPiped; // stage i feeds stage i+1 with stderr (|&) instead of stdout (|)
+    std::vector<std::string> fanoutLines; // consumers of "... |{ c1 ; c2 }", each sees the whole stream
+    pid_t lastStagePid; // its exit status is the pipeline's
+    pid_t launchStage(Command* stage, int stdinFd, int stdoutFd, int stderrFd, pid_t pgroup);
+    bool launchFanout(int producerFd, pid_t* pgroup);
 public:
     explicit PipeCommand(const char* cmd_line);
     ~PipeCommand() override = default;
     void execute() override;
+    // starts every stage as a direct child in one process group; returns the group id,
+    // 0 if nothing was launched, -1 on failure
+    pid_t launch(RedirectionCommand* redirection);
+    pid_t getLastStagePid() const { return lastStagePid; }
 };
 
 class RedirectionCommand : public Command {
@@ -53,6 +91,7 @@ public:
     explicit RedirectionCommand(const char* cmd_line);
     ~RedirectionCommand() override = default;
     void execute() override {}
+    int openTarget(); // -1 on failure
     bool prepare();
     void cleanup();
 };
@@ -92,57 +131,161 @@ public:
     void setLastPwd(const char* wd);
 };
 
+class JobMonitor;
+
+class ResourceLimits { // "limit" options, applied in a job's processes before they exec; 0 means unset
+public:
+    long long memBytes; // RLIMIT_AS, and memory.max of the job's cgroup
+    long cpuSeconds; // RLIMIT_CPU: SIGXCPU at the limit, SIGKILL a second later
+    long openFiles; // RLIMIT_NOFILE
+    double cpus; // cpu.max of the job's cgroup
+    ResourceLimits() : memBytes(0), cpuSeconds(0), openFiles(0), cpus(0) {}
+    bool isSet() const { return memBytes != 0 || cpuSeconds != 0 || openFiles != 0 || cpus != 0; }
+    bool apply(pid_t pid) const; // prlimit, 0 for the calling process
+    std::string createCgroup(const std::string& name) const; // "" when cgroup v2 isn't writable here
+    static bool joinCgroup(const std::string& path); // moves the calling process
+    static bool wasOomKilled(const std::string& path);
+    std::string describe(pid_t pid, const std::string& cgroup) const; // effective values, read back from the job
+    std::string killReason(int status, const struct rusage& usage, bool oomKilled) const; // "" if not a limit
+};
+
+class JobsPublisher { // job table and job events in /dev/shm for external monitors, layout in smash_shm.h
+    std::string path; // "" while not publishing
+    char* mapping;
+    size_t size;
+    pid_t ownerPid; // forked children share the mapping and must leave it alone
+    bool isPublishing() const;
+public:
+    JobsPublisher() : path(), mapping(nullptr), size(0), ownerPid(0) {}
+    ~JobsPublisher();
+    bool open(pid_t smashPid);
+    void close(); // flags the mapping closed for readers and unlinks it
+    void setJob(int jobId, pid_t pid, int state, time_t startTime, const std::string& commandLine, int jobCount);
+    void clearJob(int jobId, int jobCount);
+    void pushEvent(int type, int jobId, pid_t pid, int status, const std::string& commandLine);
+};
+
 class JobsList { //job-id sorted
 public:
     class JobEntry {
 	    pid_t pid;
-	    int jobId;
-        const std::string cmd_line;
+	    int jobId; //0 marks a free slot
+        std::string cmd_line;
 	    bool stopped;
+        bool queued; // waiting for a free slot under "jobslimit", pid is 0 until it starts
         time_t insertionTime;
+        int exitStatus; // wait status of the group's last reaped process, -1 while running
+        int prevStopped; // job ids linking the stopped jobs in id order, 0 at either end
+        int nextStopped;
+        int pidfd; // watched by the event loop, -1 if none
+        struct rusage usage; // summed over the group's processes reaped so far
+        ResourceLimits limits;
+        std::string cgroup; // the job's own cgroup, "" if none
+        bool oomKilled; // its cgroup's OOM killer fired
+        friend class JobsList;
 	public:
-        JobEntry(pid_t pid, int jobId, std::string cmd_line, bool stopped, time_t time);
+        JobEntry();
+        JobEntry(pid_t pid, int jobId, std::string cmd_line, time_t time);
         ~JobEntry() = default;
 		pid_t getPid() const { return pid; }
 		int getJobId() const { return jobId; }
 		bool isStopped() const { return stopped; }
-		void stop() { stopped = true; }
-		void resume() { stopped = false; }
+		bool isQueued() const { return queued; }
 		double getSecondsElapsed() const;
+        time_t getInsertionTime() const { return insertionTime; }
         void resetSecondsElapsed();
         std::string getCommandLine() const { return cmd_line; }
-        friend bool operator==(const JobEntry&, const JobEntry&);
+        int getExitStatus() const { return exitStatus; }
+        void setExitStatus(int status) { exitStatus = status; }
+        std::string describeExit() const;
+        const struct rusage& getUsage() const { return usage; }
 	};
+    static volatile sig_atomic_t childExited; // set by the SIGCHLD handler, cleared by the reaper
 private:
-    std::list<JobEntry> jobsList;
+    // slots[id - 1] holds job id, ids are handed out as max + 1 so the table stays dense and
+    // trailing free slots are trimmed; pidIndex maps a job's pid (its process group) to its id
+    std::vector<JobEntry> slots;
+    std::unordered_map<pid_t, int> pidIndex;
+    int jobsCount;
+    int lastStoppedId; // tail of the stopped jobs list, 0 if none
+    int stoppedCount;
+    std::list<int> queuedIds; // ids of queued jobs, started front first
+    std::list<JobEntry> finishedJobs; // most recent last, at most FINISHED_JOBS_HISTORY
+    std::unordered_map<pid_t, int> unclaimedExits; // emptied groups not (yet) added as jobs -> status
+    std::unordered_map<pid_t, struct rusage> unclaimedUsage; // same, for the groups' resource usage
     pid_t fgPid; //0 if no job
     std::string fgCommandLine; //"" if no job
+    pid_t fgStatusPid; //process whose exit status is the fg command's status (a pipeline's last stage)
+    int fgStatus; //its wait status, -1 until reaped
+    struct rusage fgUsage; //summed over the fg group's reaped processes, for "time"
+    int fgReaped;
+    void linkStopped(JobEntry* j);
+    void unlinkStopped(JobEntry* j);
+    void addFinishedJob(const JobEntry& j);
+    void clearSlot(JobEntry* j);
+    JobsPublisher* publisher; // nullptr unless smash publishes its jobs
+    void publish(const JobEntry& j, int event, int status = -1); // the job's slot, then the event
 public:
-    JobsList() = default;
+    JobsList();
     ~JobsList() = default;
-    void printJobsList();
+    // with a monitor, each job also gets its /proc usage; with placement, the cpus it may run on
+    void printJobsList(JobMonitor* monitor = nullptr, bool placement = false);
+    void printFinishedJobs();
+    void setPublisher(JobsPublisher* jobsPublisher) { publisher = jobsPublisher; }
+    void noteTimedOut(pid_t pid, const std::string& commandLine);
+    void clearUnclaimedExits() { unclaimedExits.clear(); unclaimedUsage.clear(); }
     void killAllJobs();
     void removeJob(pid_t pid);
     void removeFinishedJobs();
     JobEntry * getJobById(int jobId);
     JobEntry * getJobByPid(int jobPid);
+    int getFinishedStatus(pid_t pid) const; // wait status from the finished history, -1 if not there
     JobEntry * getLastJob(int* lastJobId);
     JobEntry *getLastStoppedJob(int *jobId);
+    void stopJob(JobEntry* j);
+    void resumeJob(JobEntry* j);
     void addJob(std::string CommandLine, pid_t pid, bool isStopped = false);
+    int queueJob(const std::string& commandLine); // returns the new job's id
+    void startQueuedJob(int jobId, pid_t pid);
+    void setJobLimits(pid_t pid, const ResourceLimits& limits, const std::string& cgroup);
+    void cancelQueuedJob(int jobId);
+    int getNextQueuedId() const { return queuedIds.empty() ? 0 : queuedIds.front(); }
+    int getQueuedCount() const { return (int)queuedIds.size(); }
+    int getRunningCount() const { return jobsCount - (int)queuedIds.size() - stoppedCount; }
+    int size() const { return jobsCount; }
+    bool waitForeground(pid_t pgid); // true once every process of the group is gone, false if it stopped
     pid_t getFgPid() const { return fgPid; }
     std::string getFgCommandLine() const { return fgCommandLine; }
     void setFgCommand(pid_t pid, const char* cmd_line);
     void clearFgCommand() { setFgCommand(0,""); }
+    void setFgStatusPid(pid_t pid) { fgStatusPid = pid; fgStatus = -1; }
+    int getFgStatus() const { return fgStatus; }
+    void noteReaped(pid_t pid, pid_t pgid, int status, const struct rusage& usage);
+    void resetFgUsage();
+    int getFgReaped() const { return fgReaped; }
+    const struct rusage& getFgUsage() const { return fgUsage; }
 };
 
 class JobsCommand : public BuiltInCommand {
 	JobsList* jobs;
+	JobMonitor* monitor;
+	bool verbose;
+	bool live;
 public:
-    JobsCommand(const char* cmd_line, JobsList* jobs);
+    JobsCommand(const char* cmd_line, JobsList* jobs, JobMonitor* monitor);
     ~JobsCommand() override = default;
     void execute() override;
 };
 
+class JobsTopCommand : public BuiltInCommand { // jtop [-d seconds] [-n count]: "jobs -l" refreshed until ctrl-C
+    JobsList* jobs;
+    JobMonitor* monitor;
+public:
+    JobsTopCommand(const char* cmd_line, JobsList* jobs, JobMonitor* monitor);
+    ~JobsTopCommand() override = default;
+    void execute() override;
+};
+
 class KillCommand : public BuiltInCommand {
 	JobsList* jobs;
 public:
@@ -167,8 +310,75 @@ public:
     void execute() override;
 };
 
+class CommandHash { // command name -> absolute path, like bash's hash table
+public:
+    class HashEntry {
+        std::string path;
+        unsigned long hits;
+    public:
+        explicit HashEntry(std::string path) : path(path), hits(0) {}
+        ~HashEntry() = default;
+        std::string getPath() const { return path; }
+        unsigned long getHits() const { return hits; }
+        void hit() { hits++; }
+    };
+private:
+    std::unordered_map<std::string, HashEntry> table;
+    std::string cachedPathEnv; // $PATH the table was built against
+    void checkPathEnv();
+    static std::string searchPath(const std::string& name, const std::string& pathEnv, bool* cacheable);
+public:
+    CommandHash() = default;
+    ~CommandHash() = default;
+    std::string lookup(const std::string& name); // "" if not found
+    void clear() { table.clear(); }
+    void printTable();
+};
+
+class JobMonitor { // per-process /proc files of every job's group, kept open and re-read with pread
+public:
+    class JobSample {
+    public:
+        int processes;
+        int threads;
+        double cpuPercent; // since the previous sample of each process, or over its lifetime on the first one
+        long rssKb;
+        unsigned long long readBytes; // rchar/wchar: everything passed through read/write-like calls
+        unsigned long long writeBytes;
+        JobSample() : processes(0), threads(0), cpuPercent(0), rssKb(0), readBytes(0), writeBytes(0) {}
+    };
+private:
+    class ProcFiles {
+    public:
+        int statFd;
+        int ioFd; // -1 if /proc/<pid>/io can't be read
+        unsigned long long lastTicks;
+        double lastSeconds; // CLOCK_BOOTTIME of the previous sample, 0 before the first
+    };
+    std::unordered_map<pid_t, ProcFiles> procs;
+    std::unordered_set<pid_t> foreign; // in /proc but in no job's group, not opened again while it lives
+    long ticksPerSecond;
+    long pageKb;
+    void drop(pid_t pid);
+public:
+    JobMonitor();
+    ~JobMonitor();
+    JobMonitor(JobMonitor const&) = delete;
+    void operator=(JobMonitor const&) = delete;
+    void sample(const std::unordered_set<pid_t>& groups, std::unordered_map<pid_t, JobSample>* samples);
+};
+
+class HashCommand : public BuiltInCommand {
+    CommandHash* commandHash;
+public:
+    HashCommand(const char* cmd_line, CommandHash* commandHash);
+    ~HashCommand() override = default;
+    void execute() override;
+};
+
 class QuitCommand : public BuiltInCommand {
 	JobsList* jobs;
+	int exitStatus; // the previous command's, smash resets it before running a builtin
 public: 
     QuitCommand(const char* cmd_line, JobsList* jobs);
     ~QuitCommand() override = default;
@@ -178,11 +388,114 @@ public:
 // TODO: should it really inherit from BuiltInCommand ?
 class CopyCommand : public BuiltInCommand {
 public:
+    enum Strategy { REFLINK, COPY_FILE_RANGE, SENDFILE, READ_WRITE };
+    // each returns 1 when the copy is done, 0 if the strategy is unsupported here, -1 on error;
+    // all but copyReflink stream from the current offsets, so they also append
+    static int copyReflink(int srcFd, int dstFd);
+    static int copyFileRange(int srcFd, int dstFd, off_t* copied);
+    static int copySendfile(int srcFd, int dstFd, off_t* copied);
+    static int copySplice(int srcFd, int dstFd, off_t* copied); // one side must be a pipe
+    static int copyReadWrite(int srcFd, int dstFd, off_t* copied);
+private:
+    static void copyRange(int srcFd, int dstFd, off_t begin, off_t end, Strategy* used, int* result);
+    static int copyParallel(int srcFd, int dstFd, off_t size, int workers, Strategy* used, off_t* copied);
+public:
+    static const char* strategyName(Strategy strategy);
+    // workers: 1 for a single stream, 0 to decide by file size, N for N concurrent ranges
+    static bool copyData(int srcFd, int dstFd, int* workers, Strategy* used, off_t* copied);
     explicit CopyCommand(const char* cmd_line);
     ~CopyCommand() override = default;
     void execute() override;
 };
 
+class CatCommand : public BuiltInCommand { // cat [file|-]...: no exec, the data moves inside the kernel when it can
+    bool inProcess;
+public:
+    explicit CatCommand(const char* cmd_line);
+    ~CatCommand() override = default;
+    bool isSupported(); // options and bash syntax need the real cat
+    bool isInProcess() const { return inProcess; } // only regular files, which can't block smash
+    static bool catData(int srcFd, int dstFd);
+    void execute() override;
+};
+
+class WcCommand : public BuiltInCommand { // wc [-lwc] [file|-]...: newlines and word starts counted with SSE2/AVX2
+public:
+    class Counts {
+    public:
+        unsigned long long lines;
+        unsigned long long words;
+        unsigned long long bytes;
+        bool inWord; // the last printable or whitespace byte counted was printable, carried across blocks
+        Counts() : lines(0), words(0), bytes(0), inWord(false) {}
+    };
+private:
+    bool showLines;
+    bool showWords;
+    bool showBytes;
+    bool supported;
+    bool inProcess;
+    static bool countFd(int fd, Counts* counts, bool bytesOnly);
+public:
+    explicit WcCommand(const char* cmd_line);
+    ~WcCommand() override = default;
+    bool isSupported() const { return supported; } // other options and bash syntax need the real wc
+    bool isInProcess() const { return inProcess; } // only regular files, which can't block smash
+    static void count(const char* data, size_t length, Counts* counts);
+    void execute() override;
+};
+
+class FgrepCommand : public BuiltInCommand { // fgrep [-c|-l] pattern [file|-]...: literal search, a thread per file
+public:
+    enum Mode { PRINT_LINES, COUNT_LINES, LIST_FILES };
+    class Result { // one operand's output, filled by a worker and printed in operand order
+    public:
+        std::string output;
+        unsigned long long matches;
+        int error; // errno of what failed, 0 if nothing did
+        const char* failed; // which call failed
+        bool done;
+        Result() : matches(0), error(0), failed(nullptr), done(false) {}
+    };
+private:
+    Mode mode;
+    bool supported;
+    bool inProcess;
+    int patternIndex;
+    std::string pattern;
+    // flush is called after each block with what it matched so far in result->output; false stops the search
+    void searchFd(int fd, const std::string& prefix, Result* result, const std::function<bool()>& flush) const;
+    bool searchBlock(const char* data, size_t length, const std::string& prefix, Result* result) const;
+public:
+    explicit FgrepCommand(const char* cmd_line);
+    ~FgrepCommand() override = default;
+    bool isSupported() const { return supported; } // other options and bash syntax need the real fgrep
+    bool isInProcess() const { return inProcess; } // only regular files, which can't block smash
+    static const char* find(const char* data, size_t length, const std::string& pattern); // nullptr if absent
+    void execute() override;
+};
+
+class LimitCommand : public Command { // limit [--mem size] [--cpu seconds] [--nofile n] [--cpus n] <command>
+public:
+    explicit LimitCommand(const char* cmd_line);
+    ~LimitCommand() override = default;
+    void execute() override;
+};
+
+class PinCommand : public Command { // pin <cpu list> <command>: the command's processes only run on those cpus
+public:
+    explicit PinCommand(const char* cmd_line);
+    ~PinCommand() override = default;
+    void execute() override;
+};
+
+class PlacementCommand : public BuiltInCommand { // placement [off|cores|nodes]: spreads background jobs round-robin
+public:
+    explicit PlacementCommand(const char* cmd_line);
+    ~PlacementCommand() override = default;
+    void execute() override;
+};
+
 class TimeoutCommand : public Command {
 public:
     explicit TimeoutCommand(const char* cmd_line);
@@ -190,38 +503,183 @@ public:
     void execute() override;
 };
 
-class SmallShell {
+class TimeCommand : public Command { // time <command>: wall clock and rusage of the command
+public:
+    explicit TimeCommand(const char* cmd_line);
+    ~TimeCommand() override = default;
+    void execute() override;
+};
+
+class ParallelCommand : public BuiltInCommand { // parallel [-j N] [-k] [-a file] template [::: item...]
+    JobsList* jobs;
+public:
+    ParallelCommand(const char* cmd_line, JobsList* jobs);
+    ~ParallelCommand() override = default;
+    void execute() override;
+};
+
+class StatsCommand : public BuiltInCommand { // stats [on|off|reset|-j]
+public:
+    explicit StatsCommand(const char* cmd_line);
+    ~StatsCommand() override = default;
+    void execute() override;
+};
+
+class JobsLimitCommand : public BuiltInCommand { // jobslimit [N]: at most N background jobs run, 0 for no limit
+public:
+    explicit JobsLimitCommand(const char* cmd_line);
+    ~JobsLimitCommand() override = default;
+    void execute() override;
+};
+
+class TimeoutQueue { // min-heap of timed commands by deadline, cancelled entries are dropped lazily
 public:
     class TimeoutEntry {
         pid_t pid;
-        time_t timestamp;
-        int timeoutDuration;
+        long long deadline; // CLOCK_MONOTONIC, ns
+        long long graceNs; // SIGTERM first and SIGKILL this much later; 0 sends SIGKILL right away
+        bool terminated; // SIGTERM already sent
+        unsigned long id;
         std::string commandLine;
+        friend class TimeoutQueue;
     public:
-        TimeoutEntry(pid_t pid, int timeoutDuration, std::string commandLine);
+        TimeoutEntry(pid_t pid, long long deadline, long long graceNs, unsigned long id, std::string commandLine);
         ~TimeoutEntry() = default;
         pid_t getPid() const { return pid; }
-        time_t getTimestamp() const { return timestamp; }
+        long long getDeadline() const { return deadline; }
         std::string getCommandLine() const { return commandLine; }
-        void setAlarm() const;
-        class sortByTimeToAlarm {
+        class laterDeadline {
         public:
-            sortByTimeToAlarm() = default;
-            ~sortByTimeToAlarm() = default;
-            bool operator()(const SmallShell::TimeoutEntry& t1, const SmallShell::TimeoutEntry& t2) const;
+            bool operator()(const TimeoutEntry& t1, const TimeoutEntry& t2) const { return t1.deadline > t2.deadline; }
         };
     };
+private:
+    std::vector<TimeoutEntry> heap;
+    std::unordered_map<pid_t, unsigned long> live; // pid -> id of its pending entry
+    unsigned long nextId;
+    int timerFd; // CLOCK_MONOTONIC timerfd armed at the earliest deadline, polled by EventLoop
+    pid_t ownerPid; // forked children share the timerfd and must leave it alone
+    bool isLive(const TimeoutEntry& t) const;
+    void push(const TimeoutEntry& t);
+    void dropCancelled();
+    void arm();
+public:
+    TimeoutQueue();
+    ~TimeoutQueue();
+    static long long now();
+    void schedule(pid_t pid, double seconds, double graceSeconds, const std::string& commandLine);
+    void cancel(pid_t pid);
+    void expire(); // signals every command whose deadline passed, then re-arms
+    bool acknowledge(); // consumes a timerfd expiry, false if there was none
+    int getFd() const { return timerFd; }
+    size_t size() const { return live.size(); }
+};
+
+class OutputBuffer : public std::streambuf { // batch mode stdout: endl no longer costs a write(2)
+    std::vector<char> buffer;
+    int fd;
+protected:
+    int overflow(int c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override { return 0; } // only flush() writes
+public:
+    OutputBuffer(int fd, size_t size);
+    ~OutputBuffer() override = default;
+    bool flush();
+};
+
+class ShellStats { // per-phase latency histograms and per-command counters for "stats", off unless asked for
+public:
+    enum Phase { PHASE_COMMAND, PHASE_PARSE, PHASE_LAUNCH, PHASE_WAIT, PHASE_REAP, PHASE_SIGNAL, PHASE_COUNT };
+    class Histogram { // log-linear, so percentiles are within 12.5%
+        unsigned long long buckets[STATS_BUCKETS];
+        static int bucketOf(unsigned long long ns);
+        static unsigned long long bucketLow(int bucket);
+    public:
+        unsigned long long count;
+        unsigned long long totalNs;
+        unsigned long long maxNs;
+        Histogram() { reset(); }
+        void reset();
+        void add(unsigned long long ns);
+        unsigned long long percentile(double p) const;
+    };
+    class CommandCounter {
+    public:
+        unsigned long long count;
+        unsigned long long totalNs;
+        unsigned long long maxNs;
+        CommandCounter() : count(0), totalNs(0), maxNs(0) {}
+    };
+    class Timer { // records its scope into a phase; a single branch while stats are off
+        ShellStats* stats;
+        Phase phase;
+        long long start;
+    public:
+        Timer(ShellStats* stats, Phase phase) : stats(stats), phase(phase), start(stats->enabled ? now() : 0) {}
+        ~Timer() { if (start != 0) { stats->record(phase, start); } }
+    };
+private:
+    bool enabled;
+    Histogram phases[PHASE_COUNT];
+    std::unordered_map<std::string, CommandCounter> commands; // by command name
+public:
+    ShellStats() : enabled(false), phases(), commands() {}
+    ~ShellStats() = default;
+    static long long now(); // CLOCK_MONOTONIC, ns
+    static const char* phaseName(int phase);
+    bool isEnabled() const { return enabled; }
+    void setEnabled(bool on) { enabled = on; }
+    long long start() const { return enabled ? now() : 0; } // for spans a Timer can't scope, 0 while off
+    void record(Phase phase, long long start); // ignores a start of 0
+    void recordCommand(const char* cmd_line, long long start);
+    void reset();
+    std::string describe() const;
+    std::string toJson() const;
+};
+
+class SmallShell {
 private:
     std::string timeoutOriginalCommandLine;
-    std::list<TimeoutEntry> timedCommands;
+    TimeoutQueue timeouts;
     RedirectionCommand* redirectionCommand;
-    int timeoutDuration;
+    double timeoutDuration; //seconds
+    double timeoutGrace; //seconds between SIGTERM and SIGKILL, 0 for SIGKILL only
     JobsList jobsList;
+    CommandHash commandHash;
+    JobMonitor jobMonitor;
     bool forkCommand; //C'tor set this to false
     char* prompt;  //C'tor set this to NULL
     char* lastPwd; //C'tor set this to NULL
     pid_t smashPid;
+    bool traceExec; //C'tor set this from $SMASH_TRACE
+    bool useSpawn; //C'tor set this from $SMASH_SPAWN (default on)
+    int pipeSize; //C'tor set this from $SMASH_PIPE_SIZE (0 keeps the kernel default)
+    unsigned long* execCounts; //direct and bash launches, in a shared page so that forked children count here too
+    unsigned long localExecCounts[2]; //where execCounts points if that page couldn't be mapped
+    int lastStatus; //exit code of the last command, what smash exits with
+    pid_t lastBackgroundPid; //like bash's $!
+    int jobsLimit; //running background jobs allowed before new ones are queued, 0 for no limit
+    int executeDepth; //executeCommand nesting, 1 for a line read from the input
+    int startingJobId; //queued job the next background launch belongs to, 0 if none
+    ResourceLimits limits; //set by "limit" for the command it prefixes
+    std::string limitsCgroup; //created for that command, "" once a job owns it
+    unsigned long cgroupCount;
+    enum PlacementPolicy { PLACE_OFF, PLACE_CORES, PLACE_NODES };
+    PlacementPolicy placementPolicy; //for background jobs without a "pin"
+    unsigned long placedJobs; //round-robin position
+    std::vector<cpu_set_t> numaNodes; //cpus of each node, read on first use
+    cpu_set_t pinnedCpus; //set by "pin" for the command it prefixes
+    bool pinned;
+    cpu_set_t savedCpus; //smash's own affinity while a launch runs narrowed
+    ShellStats stats;
+    JobsPublisher jobsPublisher; //C'tor opens it if $SMASH_SHM is set
+    std::string statsJsonPath; //C'tor set this from $SMASH_STATS_JSON, written at exit
+    OutputBuffer* outputBuffer; //nullptr unless in batch mode
+    std::streambuf* originalCoutBuffer;
     SmallShell();
+    pid_t spawnExternal(ExternalCommand* cmd);
+    void runCommand(const char* cmd_line);
 public:
 	~SmallShell(); //free lastPwd and prompt in D'tor
     Command *CreateCommand(const char* cmd_line);
@@ -240,14 +698,41 @@ public:
     const char* getPrompt() { return prompt; }
     char** getLastPwdPtr() { return &lastPwd; }
     JobsList* getJobsListPtr() { return &jobsList; }
+    CommandHash* getCommandHashPtr() { return &commandHash; }
+    JobMonitor* getJobMonitorPtr() { return &jobMonitor; }
+    ShellStats* getStatsPtr() { return &stats; }
     void setRedirectionCommand(RedirectionCommand* redirectionCommand);
     void clearRedirectionCommand();
-    void setTimeoutDuration(int duration) { timeoutDuration = duration; }
-    int getTimeoutDuration() const { return timeoutDuration; }
-    void manageAlarm();
+    void setTimeoutDuration(double duration, double grace = 0) { timeoutDuration = duration; timeoutGrace = grace; }
+    double getTimeoutDuration() const { return timeoutDuration; }
+    TimeoutQueue* getTimeoutsPtr() { return &timeouts; }
     pid_t getPid() const { return smashPid; }
-    TimeoutEntry popTimedoutEntry();
-    void setNewAlarm() const;
+    void noteExec(bool direct, const std::string& commandLine);
+    void noteExecFallback(const std::string& commandLine); // a direct exec that failed, bash runs it instead
+    int getLastStatus() const { return lastStatus; }
+    void setLastStatus(int status) { lastStatus = status; }
+    pid_t getLastBackgroundPid() const { return lastBackgroundPid; }
+    void setLimits(const ResourceLimits& newLimits) { limits = newLimits; }
+    bool hasLimits() const { return limits.isSet(); }
+    void applyLimits(pid_t pid); // from a launched child (0) before it execs, and from smash on it
+    void clearLimits();
+    void setPinnedCpus(const cpu_set_t& cpus) { pinnedCpus = cpus; pinned = true; }
+    int getPlacementPolicy() const { return placementPolicy; }
+    void setPlacementPolicy(int policy) { placementPolicy = (PlacementPolicy)policy; placedJobs = 0; }
+    const std::vector<cpu_set_t>& getNumaNodes();
+    bool beginPlacement(bool background); // true if smash's affinity was narrowed for the launch
+    void endPlacement();
+    int getJobsLimit() const { return jobsLimit; }
+    void setJobsLimit(int limit) { jobsLimit = limit; }
+    bool startQueuedJob(int jobId); // false if nothing could be launched, the job is dropped then
+    void startQueuedJobs(); // as many as the limit allows, only between commands
+    void setBatchMode(); // buffer our own output until something else may write to the same place
+    void flushOutput();
+    bool isTraceEnabled() const { return traceExec; }
+    bool isSpawnEnabled() const { return useSpawn; }
+    int getPipeSize() const { return pipeSize; }
+    unsigned long getDirectExecCount() const { return __atomic_load_n(&execCounts[0], __ATOMIC_RELAXED); }
+    unsigned long getBashExecCount() const { return __atomic_load_n(&execCounts[1], __ATOMIC_RELAXED); }
 };
 
 
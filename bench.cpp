@@ -0,0 +1,518 @@
+// smash_bench: benchmarks of the paths smash spends its time in, as one JSON document on stdout
+//   smash_bench [-q] [smash binary]     -q runs smaller sizes, the binary defaults to ./smash
+// In-process benchmarks link the shell itself; each group runs in a forked child so it gets a
+// fresh SmallShell (SMASH_SPAWN is read once) and its memory ballast doesn't leak into the next.
+// End-to-end ones run the smash binary on generated input and time it from outside.
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include "Commands.h"
+
+static bool quick = false;
+static std::string smashPath = "./smash";
+static std::string workDir;
+static int resultsFd = -1; //where _report writes, a pipe to the parent inside _isolated
+
+static double _now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// one result per line: {"name": ..., "params": {...}, "value": ..., "unit": ...}
+static void _report(const std::string& name, const std::string& params, double value, const std::string& unit) {
+    std::ostringstream line;
+    line << "{\"name\": \"" << name << "\", \"params\": {" << params << "}, \"value\": " << std::fixed <<
+         std::setprecision(3) << value << ", \"unit\": \"" << unit << "\"}\n";
+    std::string text = line.str();
+    if (write(resultsFd, text.c_str(), text.size()) != (ssize_t)text.size()) {
+        perror("smash_bench: write failed");
+    }
+}
+
+// runs a group in a child with stdout on /dev/null, returns the result lines it reported
+static std::string _isolated(const std::function<void()>& group) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("smash_bench: pipe failed");
+        return "";
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("smash_bench: fork failed");
+        return "";
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        resultsFd = fds[1];
+        int null = open("/dev/null", O_WRONLY);
+        if (null != -1) {
+            dup2(null, 1);
+            close(null);
+        }
+        group();
+        std::cout.flush();
+        _exit(0);
+    }
+    close(fds[1]);
+    std::string results;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0 || (n == -1 && errno == EINTR)) {
+        results.append(buffer, n > 0 ? n : 0);
+    }
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "smash_bench: a benchmark group failed (status " << status << ")" << std::endl;
+    }
+    return results;
+}
+
+// wall time of one smash run, stdout and stderr on /dev/null; -1 if it failed
+static double _runSmash(const std::vector<std::string>& args) {
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(smashPath.c_str()));
+    for (const std::string& a : args) {
+        argv.push_back(const_cast<char*>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+    double start = _now();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("smash_bench: fork failed");
+        return -1;
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        dup2(null, 2);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+    double elapsed = _now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        std::cerr << "smash_bench: " << smashPath << " failed" << std::endl;
+        return -1;
+    }
+    return elapsed;
+}
+
+// fastest of a few runs, what's left once scheduling noise is gone
+static double _bestRun(const std::vector<std::string>& args, int runs) {
+    double best = -1;
+    for (int i = 0; i < runs; ++i) {
+        double t = _runSmash(args);
+        if (t >= 0 && (best < 0 || t < best)) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+static bool _writeFile(const std::string& path, const std::string& text) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = write(fd, text.c_str(), text.size()) == (ssize_t)text.size();
+    close(fd);
+    return ok;
+}
+
+static bool _makeFile(const std::string& path, long long bytes) {
+    std::string block(1 << 20, '\0');
+    for (size_t i = 0; i < block.size(); ++i) {
+        block[i] = (char)('a' + (i * 7919) % 26);
+    }
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("smash_bench: open failed");
+        return false;
+    }
+    for (long long done = 0; done < bytes; done += (long long)block.size()) {
+        size_t n = (size_t)std::min<long long>(block.size(), bytes - done);
+        if (write(fd, block.data(), n) != (ssize_t)n) {
+            perror("smash_bench: write failed");
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+    return true;
+}
+
+// words of 1 to 12 letters separated by spaces, a tab now and then, lines of about 60 bytes
+static bool _makeTextFile(const std::string& path, long long bytes) {
+    std::mt19937 random(42);
+    std::string block;
+    while (block.size() < (1 << 20)) {
+        block.append(1 + random() % 12, (char)('a' + random() % 26));
+        int separator = random() % 10;
+        block += (separator == 0) ? '\n' : (separator == 1) ? '\t' : ' ';
+    }
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("smash_bench: open failed");
+        return false;
+    }
+    for (long long done = 0; done < bytes; done += (long long)block.size()) {
+        size_t n = (size_t)std::min<long long>(block.size(), bytes - done);
+        if (write(fd, block.data(), n) != (ssize_t)n) {
+            perror("smash_bench: write failed");
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+    return true;
+}
+
+class ParseOnly : public Command { // just the tokenizer
+public:
+    explicit ParseOnly(const char* cmd_line) : Command(cmd_line) {}
+    void execute() override {}
+};
+
+// launching a command through executeCommand, for either launch path, as smash's own RSS grows
+static void benchLaunch(bool spawn, long ballastMb) {
+    setenv("SMASH_SPAWN", spawn ? "1" : "0", 1);
+    std::vector<char> ballast((size_t)ballastMb << 20, 1); //touched, so fork has page tables to copy
+    SmallShell& smash = SmallShell::getInstance();
+    std::string params = std::string("\"spawn\": ") + (spawn ? "true" : "false") + ", \"rss_mb\": " +
+                         std::to_string(ballastMb);
+    int n = quick ? 200 : 2000;
+    for (int i = 0; i < 20; ++i) {
+        smash.executeCommand("/bin/true");
+    }
+    double start = _now();
+    for (int i = 0; i < n; ++i) {
+        smash.executeCommand("/bin/true");
+    }
+    _report("launch.external", params, (_now() - start) / n * 1e6, "us");
+    if (ballastMb == 0 && spawn) { //builtins never fork, one size is enough; also what "stats" costs
+        n *= 50;
+        for (bool stats : {false, true}) {
+            smash.getStatsPtr()->setEnabled(stats);
+            start = _now();
+            for (int i = 0; i < n; ++i) {
+                smash.executeCommand("cd .");
+            }
+            _report("launch.builtin", std::string("\"stats\": ") + (stats ? "true" : "false"),
+                    (_now() - start) / n * 1e6, "us");
+        }
+    }
+}
+
+static void benchJobs(int n) {
+    JobsList jobs;
+    std::string params = "\"jobs\": " + std::to_string(n);
+    std::vector<pid_t> pids(n);
+    for (int i = 0; i < n; ++i) {
+        pids[i] = 5000000 + i; //above any pid_max, nothing is ever signalled
+    }
+    std::mt19937 random(n);
+    double start = _now();
+    for (int i = 0; i < n; ++i) {
+        jobs.addJob("sleep 100 &", pids[i]);
+    }
+    _report("jobs.add", params, (_now() - start) / n * 1e9, "ns");
+    std::vector<int> order(n);
+    for (int i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), random);
+    long found = 0;
+    start = _now();
+    for (int i : order) {
+        found += jobs.getJobById(i + 1) != nullptr;
+    }
+    _report("jobs.find_id", params, (_now() - start) / n * 1e9, "ns");
+    start = _now();
+    for (int i : order) {
+        found += jobs.getJobByPid(pids[i]) != nullptr;
+    }
+    _report("jobs.find_pid", params, (_now() - start) / n * 1e9, "ns");
+    int stops = std::min(n, 1000); //stopped jobs are kept in id order, inserting is linear
+    start = _now();
+    for (int i = 0; i < stops; ++i) {
+        jobs.stopJob(jobs.getJobById(order[i] + 1));
+    }
+    int lastId = 0;
+    for (int i = 0; i < stops; ++i) {
+        JobsList::JobEntry* j = jobs.getLastStoppedJob(&lastId);
+        jobs.resumeJob(j);
+    }
+    _report("jobs.stop_resume", params, (_now() - start) / stops * 1e9, "ns");
+    start = _now();
+    jobs.printJobsList();
+    _report("jobs.list", params, (_now() - start) * 1e3, "ms");
+    start = _now();
+    for (int i : order) {
+        jobs.removeJob(pids[i]);
+    }
+    _report("jobs.remove", params, (_now() - start) / n * 1e9, "ns");
+    if (found != 2L * n || jobs.size() != 0) {
+        std::cerr << "smash_bench: job table lost entries" << std::endl;
+    }
+}
+
+static void benchTimeouts(int n) {
+    TimeoutQueue timeouts;
+    std::string params = "\"timers\": " + std::to_string(n);
+    std::mt19937 random(n);
+    std::vector<pid_t> pids(n);
+    for (int i = 0; i < n; ++i) {
+        pids[i] = 5000000 + i;
+    }
+    double start = _now();
+    for (int i = 0; i < n; ++i) { //far enough out that nothing expires while measuring
+        timeouts.schedule(pids[i], 1e6 + (double)(random() % 100000), 0, "sleep 100");
+    }
+    _report("timeouts.schedule", params, (_now() - start) / n * 1e9, "ns");
+    std::shuffle(pids.begin(), pids.end(), random);
+    start = _now();
+    for (pid_t pid : pids) {
+        timeouts.cancel(pid);
+    }
+    _report("timeouts.cancel", params, (_now() - start) / n * 1e9, "ns");
+}
+
+static void benchParser() {
+    std::string longLine = "gcc";
+    for (int i = 0; i < 40; ++i) {
+        longLine += " -Wsome-warning-" + std::to_string(i);
+    }
+    const char* lines[][2] = {{"short", "ls -l /tmp"}, {"background", "  sleep   10   &  "},
+                              {"long", longLine.c_str()}};
+    int n = quick ? 100000 : 1000000;
+    for (const auto& line : lines) {
+        double start = _now();
+        for (int i = 0; i < n; ++i) {
+            ParseOnly command(line[1]);
+        }
+        _report("parser.tokenize", std::string("\"line\": \"") + line[0] + "\"", (_now() - start) / n * 1e9, "ns");
+    }
+    n /= 10;
+    double start = _now();
+    for (int i = 0; i < n; ++i) { //tokenize, bash check and the PATH lookup through the hash
+        ExternalCommand command("ls -l /tmp");
+    }
+    _report("parser.external", "", (_now() - start) / n * 1e9, "ns");
+}
+
+static void benchPipes() {
+    long long bytes = quick ? (64LL << 20) : (512LL << 20);
+    for (int stages : {2, 4, 8}) {
+        std::string line = "head -c " + std::to_string(bytes) + " /dev/zero";
+        for (int i = 2; i < stages; ++i) {
+            line += " | cat";
+        }
+        line += " | wc -c";
+        double t = _bestRun({"-c", line}, 3);
+        if (t > 0) {
+            _report("pipe.throughput", "\"stages\": " + std::to_string(stages), bytes / t / (1 << 20), "MB/s");
+        }
+    }
+}
+
+static void benchCopy() {
+    double startup = _bestRun({"-c", ""}, 5);
+    std::vector<long long> sizes = {1LL << 20, 16LL << 20};
+    if (!quick) {
+        sizes.push_back(256LL << 20);
+    }
+    std::string dst = workDir + "/copy.dst";
+    for (long long size : sizes) {
+        std::string src = workDir + "/copy." + std::to_string(size);
+        if (!_makeFile(src, size)) {
+            return;
+        }
+        double best = -1;
+        for (int i = 0; i < 3; ++i) {
+            unlink(dst.c_str());
+            double t = _runSmash({"-c", "cp " + src + " " + dst});
+            if (t >= 0 && (best < 0 || t < best)) {
+                best = t;
+            }
+        }
+        unlink(dst.c_str());
+        if (best > 0) {
+            _report("cp.throughput", "\"bytes\": " + std::to_string(size),
+                    size / std::max(best - startup, 1e-6) / (1 << 20), "MB/s");
+        }
+        const char* cats[][2] = {{"file", " > "}, {"pipe", " | wc -c > "}};
+        for (const auto& cat : cats) {
+            double t = _bestRun({"-c", "cat " + src + cat[1] + dst}, 3);
+            unlink(dst.c_str());
+            if (t > 0) {
+                _report("cat.throughput", "\"bytes\": " + std::to_string(size) + ", \"to\": \"" + cat[0] + "\"",
+                        size / std::max(t - startup, 1e-6) / (1 << 20), "MB/s");
+            }
+        }
+        unlink(src.c_str());
+    }
+}
+
+// the wc builtin with each kernel against coreutils wc, on a file and through a pipe. Both run
+// under smash so its startup cancels out, and in the C locale, which is what the builtin counts in
+static void benchWc() {
+    long long size = quick ? (256LL << 20) : (2LL << 30);
+    std::string src = workDir + "/wc.txt";
+    if (!_makeTextFile(src, size)) {
+        return;
+    }
+    setenv("LC_ALL", "C", 1);
+    _runSmash({"-c", "cat " + src + " > /dev/null"}); //into the page cache
+    for (const char* input : {"file", "pipe"}) {
+        for (const char* wc : {"scalar", "sse2", "avx2", "/usr/bin/wc"}) {
+            bool builtin = (wc[0] != '/');
+            std::string command = builtin ? "wc" : wc;
+            std::string line = (strcmp(input, "file") == 0) ? command + " " + src : "cat " + src + " | " + command;
+            if (builtin) {
+                setenv("SMASH_WC_KERNEL", wc, 1);
+            }
+            double t = _bestRun({"-c", line}, 3);
+            unsetenv("SMASH_WC_KERNEL");
+            if (t > 0) {
+                _report("wc.throughput", "\"bytes\": " + std::to_string(size) + ", \"input\": \"" + input +
+                        "\", \"wc\": \"" + (builtin ? wc : "coreutils") + "\"", size / t / (1 << 20), "MB/s");
+            }
+        }
+    }
+    unlink(src.c_str());
+}
+
+// fgrep -c for a literal the text doesn't hold, so the whole input goes through the filter: the
+// builtin with each kernel against grep -F, on a file and through a pipe
+static void benchFgrep() {
+    long long size = quick ? (256LL << 20) : (2LL << 30);
+    std::string src = workDir + "/fgrep.txt";
+    if (!_makeTextFile(src, size)) {
+        return;
+    }
+    setenv("LC_ALL", "C", 1);
+    _runSmash({"-c", "cat " + src + " > /dev/null"}); //into the page cache
+    for (const char* input : {"file", "pipe"}) {
+        for (const char* kernel : {"scalar", "sse2", "avx2", "grep"}) {
+            bool builtin = strcmp(kernel, "grep") != 0;
+            std::string command = builtin ? "fgrep -c needle" : "/usr/bin/grep -F -c needle";
+            std::string line = (strcmp(input, "file") == 0) ? command + " " + src : "cat " + src + " | " + command;
+            if (builtin) {
+                setenv("SMASH_FGREP_KERNEL", kernel, 1);
+            }
+            double t = _bestRun({"-c", line}, 3);
+            unsetenv("SMASH_FGREP_KERNEL");
+            if (t > 0) {
+                _report("fgrep.throughput", "\"bytes\": " + std::to_string(size) + ", \"input\": \"" + input +
+                        "\", \"fgrep\": \"" + (builtin ? kernel : "grep") + "\"", size / t / (1 << 20), "MB/s");
+            }
+        }
+    }
+    unlink(src.c_str());
+}
+
+static void benchBatch() {
+    int n = quick ? 20000 : 200000;
+    const char* scripts[][2] = {{"silent", "cd .\n"}, {"output", "showpid\n"}, {"external", "/bin/true\n"}};
+    for (const auto& script : scripts) {
+        int lines = (strcmp(script[0], "external") == 0) ? n / 100 : n;
+        std::string text;
+        for (int i = 0; i < lines; ++i) {
+            text += script[1];
+        }
+        std::string path = workDir + "/batch." + script[0];
+        if (!_writeFile(path, text)) {
+            perror("smash_bench: write failed");
+            return;
+        }
+        double t = _bestRun({path}, 3);
+        unlink(path.c_str());
+        if (t > 0) {
+            _report("batch.lines", std::string("\"script\": \"") + script[0] + "\"", lines / t, "lines/s");
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-q") == 0) {
+            quick = true;
+        } else if (argv[i][0] != '-' && i == argc - 1) {
+            smashPath = argv[i];
+        } else {
+            std::cerr << "usage: smash_bench [-q] [smash binary]" << std::endl;
+            return 2;
+        }
+    }
+    if (access(smashPath.c_str(), X_OK) == -1) {
+        std::cerr << "smash_bench: " << smashPath << " is not executable, build it first" << std::endl;
+        return 1;
+    }
+    char dirTemplate[] = "/tmp/smash-bench-XXXXXX";
+    if (mkdtemp(dirTemplate) == nullptr) {
+        perror("smash_bench: mkdtemp failed");
+        return 1;
+    }
+    workDir = dirTemplate;
+    std::vector<std::string> groups;
+    std::vector<long> ballastMb = {0, 256};
+    if (!quick) {
+        ballastMb.push_back(1024);
+    }
+    for (bool spawn : {true, false}) {
+        for (long mb : ballastMb) {
+            groups.push_back(_isolated([=]() { benchLaunch(spawn, mb); }));
+        }
+    }
+    for (int n : {1000, 10000, 100000}) {
+        groups.push_back(_isolated([=]() { benchJobs(n); }));
+    }
+    for (int n : {1000, 100000}) {
+        groups.push_back(_isolated([=]() { benchTimeouts(n); }));
+    }
+    groups.push_back(_isolated(benchParser));
+    groups.push_back(_isolated(benchPipes));
+    groups.push_back(_isolated(benchCopy));
+    groups.push_back(_isolated(benchWc));
+    groups.push_back(_isolated(benchFgrep));
+    groups.push_back(_isolated(benchBatch));
+    rmdir(workDir.c_str());
+
+    struct utsname host;
+    uname(&host);
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    std::cout << "{\n  \"benchmark\": \"smash\",\n  \"version\": 1,\n  \"date\": \"" << date << "\",\n" <<
+              "  \"host\": {\"kernel\": \"" << host.release << "\", \"machine\": \"" << host.machine <<
+              "\", \"cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << "},\n  \"quick\": " <<
+              (quick ? "true" : "false") << ",\n  \"results\": [";
+    bool first = true;
+    for (const std::string& group : groups) {
+        std::istringstream lines(group);
+        std::string line;
+        while (std::getline(lines, line)) {
+            std::cout << (first ? "\n    " : ",\n    ") << line;
+            first = false;
+        }
+    }
+    std::cout << "\n  ]\n}" << std::endl;
+    return 0;
+}
@@ -1,10 +1,29 @@
 #include <iostream>
 #include <signal.h>
+#include <unistd.h>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <time.h>
 #include "signals.h"
 #include "Commands.h"
 
 using namespace std;
 
+#define EVENT_TAG_STDIN (1ULL << 32)
+#define EVENT_TAG_SIGNAL (2ULL << 32)
+#define EVENT_TAG_TIMER (3ULL << 32)
+#define EVENT_TAG_PID (4ULL << 32) // low 32 bits hold the pid
+#define EVENT_TAG_MASK (~0ULL << 32)
+#define INPUT_BLOCK_SIZE (64 * 1024)
+#define MAX_EVENTS (64)
+
 void ctrlZHandler(int sig_num) {
     std::cout << "smash: got ctrl-Z" << endl;
     SmallShell& smash = SmallShell::getInstance();
@@ -21,7 +40,7 @@ void ctrlZHandler(int sig_num) {
     if (j == nullptr) {
         jobs->addJob(jobs->getFgCommandLine(), pid, true);
         j = jobs->getJobByPid(pid);
-    } else { j->stop(); }
+    } else { jobs->stopJob(j); }
     j->resetSecondsElapsed();
     jobs->clearFgCommand();
     std::cout << "smash: process " << pid << " was stopped" << endl;
@@ -43,6 +62,7 @@ void ctrlCHandler(int sig_num) {
     if (j != nullptr) {
         jobs->removeJob(pid);
     }
+    smash.getTimeoutsPtr()->cancel(pid);
     jobs->clearFgCommand();
     std::cout << "smash: process " << pid << " was killed" << endl;
 }
@@ -51,17 +71,322 @@ void alarmHandler(int sig_num) {
     std::cout << "smash: got an alarm" << endl;
     SmallShell &smash = SmallShell::getInstance();
     smash.getJobsListPtr()->removeFinishedJobs();
-    SmallShell::TimeoutEntry t = smash.popTimedoutEntry();
-    pid_t pid = t.getPid();
-    if (pid != 0) {
-        if (kill((-1) * pid, SIGKILL) == -1) { //signal to GROUP
-            if (errno != ESRCH) { //unexpected error
-                perror("smash error: kill failed");
-                return;
+    smash.getTimeoutsPtr()->expire();
+}
+
+void childHandler(int sig_num) {
+    JobsList::childExited = 1;
+    SmallShell::getInstance().getJobsListPtr()->removeFinishedJobs();
+}
+
+EventLoop::EventLoop() : epollFd(-1), signalFd(-1), inputFd(0), stdinWatched(false), stdinPollable(true),
+        inputClosed(false), inputStorage(), inputData(nullptr), inputLen(0), inputPos(0), mappedInput(nullptr),
+        ownerPid(0), interrupts(0) {}
+
+EventLoop::~EventLoop() {
+    if (mappedInput != nullptr) {
+        munmap(mappedInput, inputLen);
+    }
+    if (epollFd != -1) {
+        close(epollFd);
+    }
+    if (signalFd != -1) {
+        close(signalFd);
+    }
+}
+
+void EventLoop::handledSignals(sigset_t* set) {
+    sigemptyset(set);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGTSTP);
+    sigaddset(set, SIGCHLD);
+    sigaddset(set, SIGALRM);
+}
+
+void EventLoop::resetChildSignals() { // the mask survives fork and exec, the child wants them back
+    sigset_t set;
+    handledSignals(&set);
+    sigprocmask(SIG_UNBLOCK, &set, nullptr);
+}
+
+bool EventLoop::init() {
+    sigset_t set;
+    handledSignals(&set);
+    if (sigprocmask(SIG_BLOCK, &set, nullptr) == -1) {
+        perror("smash error: sigprocmask failed");
+        return false;
+    }
+    signalFd = signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC);
+    if (signalFd == -1) {
+        perror("smash error: signalfd failed");
+        return false;
+    }
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1) {
+        perror("smash error: epoll_create1 failed");
+        return false;
+    }
+    ownerPid = getpid();
+    if (!watchFd(signalFd, EVENT_TAG_SIGNAL)) {
+        return false;
+    }
+    int timerFd = SmallShell::getInstance().getTimeoutsPtr()->getFd();
+    return timerFd == -1 || watchFd(timerFd, EVENT_TAG_TIMER);
+}
+
+bool EventLoop::setInputString(const char* commands) {
+    inputStorage = commands;
+    inputData = inputStorage.data();
+    inputLen = inputStorage.length();
+    inputClosed = true;
+    return true;
+}
+
+bool EventLoop::setInputFile(const char* path) {
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd == -1) {
+        perror("smash error: open failed");
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) { //whole script at once, no read copies
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            mappedInput = data;
+            inputData = (const char*)data;
+            inputLen = st.st_size;
+            inputClosed = true;
+            return true;
+        }
+    }
+    inputFd = fd; //fifo, empty file or mmap refused - stream it
+    return true;
+}
+
+bool EventLoop::isActive() const {
+    return epollFd != -1 && getpid() == ownerPid;
+}
+
+bool EventLoop::watchFd(int fd, unsigned long long tag) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = tag;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("smash error: epoll_ctl failed");
+        return false;
+    }
+    return true;
+}
+
+int EventLoop::watchPid(pid_t pid) {
+    if (!isActive()) {
+        return -1;
+    }
+    int fd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (fd == -1) { //old kernel or already reaped - SIGCHLD still covers it
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (!watchFd(fd, EVENT_TAG_PID | (unsigned long long)(unsigned int)pid)) {
+        close(fd);
+        return -1;
+    }
+    return fd; //closing it also drops it from the epoll set
+}
+
+void EventLoop::setStdinWatched(bool watched) {
+    if (watched == stdinWatched || !stdinPollable) {
+        return;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_TAG_STDIN;
+    if (epoll_ctl(epollFd, watched ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, inputFd, &ev) == -1) {
+        if (errno == EPERM) { //regular file
+            stdinPollable = false;
+            return;
+        }
+        perror("smash error: epoll_ctl failed");
+        return;
+    }
+    stdinWatched = watched;
+}
+
+void EventLoop::handleSignals() {
+    struct signalfd_siginfo info;
+    while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+        switch (info.ssi_signo) {
+            case SIGINT: interrupts++; ctrlCHandler(SIGINT); break;
+            case SIGTSTP: ctrlZHandler(SIGTSTP); break;
+            case SIGALRM: alarmHandler(SIGALRM); break;
+            case SIGCHLD: childHandler(SIGCHLD); break;
+            default: break;
+        }
+    }
+}
+
+bool EventLoop::fillInput() {
+    if (inputPos > 0 && inputPos >= inputStorage.length() / 2) { //drop consumed lines in one move
+        inputStorage.erase(0, inputPos);
+        inputPos = 0;
+        inputData = inputStorage.data();
+        inputLen = inputStorage.length();
+    }
+    char buf[INPUT_BLOCK_SIZE];
+    ssize_t n = read(inputFd, buf, sizeof(buf));
+    if (n == -1) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return true;
+        }
+        perror("smash error: read failed");
+        inputClosed = true;
+        return false;
+    }
+    if (n == 0) {
+        inputClosed = true;
+        return false;
+    }
+    inputStorage.append(buf, n);
+    inputData = inputStorage.data();
+    inputLen = inputStorage.length();
+    return true;
+}
+
+void EventLoop::dispatch(int timeoutMs) {
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epollFd, events, MAX_EVENTS, timeoutMs);
+    if (n == -1) {
+        if (errno != EINTR) {
+            perror("smash error: epoll_wait failed");
+        }
+        return;
+    }
+    for (int i = 0; i < n; ++i) {
+        unsigned long long tag = events[i].data.u64;
+        switch (tag & EVENT_TAG_MASK) {
+            case EVENT_TAG_STDIN:
+                fillInput();
+                if (inputClosed) {
+                    setStdinWatched(false);
+                }
+                break;
+            case EVENT_TAG_SIGNAL: {
+                ShellStats::Timer timer(SmallShell::getInstance().getStatsPtr(), ShellStats::PHASE_SIGNAL);
+                handleSignals();
+                break;
+            }
+            case EVENT_TAG_TIMER: {
+                ShellStats::Timer timer(SmallShell::getInstance().getStatsPtr(), ShellStats::PHASE_SIGNAL);
+                if (SmallShell::getInstance().getTimeoutsPtr()->acknowledge()) {
+                    alarmHandler(SIGALRM);
+                }
+                break;
+            }
+            case EVENT_TAG_PID: {
+                ShellStats::Timer timer(SmallShell::getInstance().getStatsPtr(), ShellStats::PHASE_SIGNAL);
+                childHandler(SIGCHLD);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+bool EventLoop::readLine(std::string* line) {
+    while (true) {
+        SmallShell::getInstance().startQueuedJobs(); //slots freed by what was just handled
+        const char* start = inputData + inputPos;
+        const char* newline = (inputPos < inputLen) ? (const char*)memchr(start, '\n', inputLen - inputPos) : nullptr;
+        if (newline != nullptr) {
+            line->assign(start, newline - start);
+            inputPos += newline - start + 1;
+            return true;
+        }
+        if (inputClosed) {
+            if (inputPos == inputLen) {
+                return false;
             }
-        } else { //signal sent successfully
-            std::cout << "smash: " << t.getCommandLine() << " timed out!" << endl;
+            line->assign(start, inputLen - inputPos); //last line without a newline
+            inputPos = inputLen;
+            return true;
         }
+        setStdinWatched(true);
+        if (stdinPollable) {
+            dispatch(-1);
+        } else {
+            dispatch(0); //events that are already due, then a read that can't block for long
+            fillInput();
+        }
+    }
+}
+
+bool EventLoop::waitForeground(pid_t pgid) {
+    setStdinWatched(false); //input belongs to the fg job now
+    JobsList* jobs = SmallShell::getInstance().getJobsListPtr();
+    while (true) {
+        int status = 0;
+        struct rusage usage;
+        pid_t pid = wait4(-pgid, &status, WUNTRACED|WNOHANG, &usage);
+        if (pid > 0) {
+            if (WIFSTOPPED(status)) {
+                return false;
+            }
+            jobs->noteReaped(pid, pgid, status, usage);
+            continue;
+        }
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ECHILD) {
+                return true;
+            }
+            perror("smash error: wait4 failed");
+            return false;
+        }
+        if (jobs->getFgPid() != pgid) { //ctrl-Z or ctrl-C already dealt with it
+            return false;
+        }
+        dispatch(-1); //a SIGCHLD for the group wakes us up
+    }
+}
+
+bool EventLoop::pause(int timeoutMs) {
+    if (!isActive()) {
+        poll(nullptr, 0, timeoutMs);
+        return true;
+    }
+    setStdinWatched(false);
+    unsigned long before = interrupts;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long deadline = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + timeoutMs;
+    while (interrupts == before) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long remaining = deadline - (now.tv_sec * 1000LL + now.tv_nsec / 1000000);
+        if (remaining <= 0) {
+            return true;
+        }
+        dispatch((int)remaining);
+    }
+    return false;
+}
+
+bool EventLoop::waitEvents() {
+    if (!isActive()) { //nested in a forked child: children are the only events
+        siginfo_t info;
+        while (waitid(P_ALL, 0, &info, WEXITED|WNOWAIT) == -1 && errno == EINTR) {}
+        JobsList::childExited = 1;
+        SmallShell::getInstance().getJobsListPtr()->removeFinishedJobs();
+        return true;
     }
-    smash.setNewAlarm();
+    setStdinWatched(false);
+    unsigned long before = interrupts;
+    dispatch(-1);
+    return interrupts == before;
 }
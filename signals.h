@@ -1,8 +1,58 @@
 #ifndef SMASH__SIGNALS_H_
 #define SMASH__SIGNALS_H_
 
+#include <string>
+#include <csignal>
+#include <sys/types.h>
+
+// Run from EventLoop (never in signal context), so they may print and touch the jobs list freely.
 void ctrlZHandler(int sig_num);
 void ctrlCHandler(int sig_num);
 void alarmHandler(int sig_num);
+void childHandler(int sig_num);
+
+// Single-threaded epoll reactor: stdin, a signalfd for SIGINT/SIGTSTP/SIGCHLD/SIGALRM,
+// the timeouts timerfd and one pidfd per background job.
+class EventLoop {
+    int epollFd;
+    int signalFd;
+    int inputFd; // stdin, or the script being run
+    bool stdinWatched; // input is only polled while reading a command, never while a job runs in the fg
+    bool stdinPollable; // false for regular files, which epoll rejects and which never block anyway
+    bool inputClosed;
+    std::string inputStorage; // streamed input, read in big blocks
+    const char* inputData; // inputStorage's bytes, a "-c" string or an mmap()ed script
+    size_t inputLen;
+    size_t inputPos; // start of the unread part of inputData
+    void* mappedInput;
+    pid_t ownerPid; // forked children inherit the epoll instance but must not use it
+    unsigned long interrupts; // ctrl-C count, lets a builtin that waits notice one
+    EventLoop();
+    void setStdinWatched(bool watched);
+    void handleSignals();
+    void dispatch(int timeoutMs);
+    bool fillInput();
+public:
+    ~EventLoop();
+    EventLoop(EventLoop const&) = delete;
+    void operator=(EventLoop const&) = delete;
+    static EventLoop& getInstance()
+    {
+      static EventLoop instance;
+      return instance;
+    }
+    static void handledSignals(sigset_t* set);
+    static void resetChildSignals(); // call right after fork() in a child that keeps running smash code
+    bool init();
+    bool setInputString(const char* commands); // smash -c
+    bool setInputFile(const char* path); // smash script
+    bool isActive() const;
+    bool watchFd(int fd, unsigned long long tag);
+    int watchPid(pid_t pid); // pidfd readable once pid exits, -1 if unsupported
+    bool readLine(std::string* line); // false at EOF
+    bool waitForeground(pid_t pgid); // true once every process of the group is gone, false if it stopped
+    bool pause(int timeoutMs); // keeps handling events meanwhile; false if ctrl-C cut it short
+    bool waitEvents(); // blocks until something is handled (e.g. a child exits); false if it was ctrl-C
+};
 
 #endif //SMASH__SIGNALS_H_
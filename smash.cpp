@@ -2,33 +2,50 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <csignal>
+#include <cstring>
 #include "Commands.h"
 #include "signals.h"
 
 int main(int argc, char* argv[]) {
-    if(signal(SIGTSTP , ctrlZHandler)==SIG_ERR) {
-        perror("smash error: failed to set ctrl-Z handler");
+    SmallShell& smash = SmallShell::getInstance();
+    EventLoop& loop = EventLoop::getInstance();
+    bool interactive = true;
+    if (argc == 3 && strcmp(argv[1], "-c") == 0) { //smash -c "<commands>"
+        loop.setInputString(argv[2]);
+        interactive = false;
+    } else if (argc == 2 && argv[1][0] != '-') { //smash <script>
+        if (!loop.setInputFile(argv[1])) {
+            return 1;
+        }
+        interactive = false;
+    } else if (argc != 1) {
+        std::cerr << "smash error: usage: smash [-c commands | script]" << std::endl;
+        return 2;
     }
-    if(signal(SIGINT , ctrlCHandler)==SIG_ERR) {
-        perror("smash error: failed to set ctrl-C handler");
+    if (!interactive) { //no prompts, and builtin output is written in large blocks
+        smash.setBatchMode();
     }
-    struct sigaction sa;
-    sa.sa_handler = alarmHandler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    if (sigaction(SIGALRM, &sa, nullptr) == -1) {
-        perror("smash error: failed to set alarm handler");
+    if (!loop.init()) { //signals, job exits and timeouts all arrive through the loop
+        return 1;
     }
-    SmallShell& smash = SmallShell::getInstance();
     while(true) {
-        if (smash.isPromptDefault()) {
-			std::cout << "smash> ";
-		} else {
-			std::cout << smash.getPrompt() << "> ";
-		}
+        if (interactive) {
+            if (smash.isPromptDefault()) {
+                std::cout << "smash> ";
+            } else {
+                std::cout << smash.getPrompt() << "> ";
+            }
+            std::cout.flush();
+        }
         std::string cmd_line;
-        std::getline(std::cin, cmd_line);
+        if (!loop.readLine(&cmd_line)) { //EOF
+            break;
+        }
         smash.executeCommand(cmd_line.c_str());
     }
-    return 0;
+    while (smash.getJobsListPtr()->getQueuedCount() > 0 && loop.waitEvents()) { //input ended, queued jobs still run
+        smash.startQueuedJobs();
+    }
+    smash.flushOutput();
+    return smash.getLastStatus();
 }
@@ -0,0 +1,174 @@
+// smash_jobs: reads the job table and job events a smash started with SMASH_SHM=1 publishes
+//   smash_jobs <smash pid>        the jobs, like "jobs"
+//   smash_jobs -e <smash pid>     the events still in the ring
+//   smash_jobs -f <smash pid>     those, then new ones as they come, until smash exits
+// Only the mapping is read, see smash_shm.h; no syscall is made per query.
+#include <unistd.h>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "smash_shm.h"
+
+static const char* _eventName(uint32_t type) {
+    switch (type) {
+        case SMASH_EVENT_STARTED: return "started";
+        case SMASH_EVENT_STOPPED: return "stopped";
+        case SMASH_EVENT_RESUMED: return "resumed";
+        case SMASH_EVENT_FINISHED: return "finished";
+        case SMASH_EVENT_TIMED_OUT: return "timed out";
+        case SMASH_EVENT_QUEUED: return "queued";
+        case SMASH_EVENT_CANCELLED: return "cancelled";
+        default: return "unknown";
+    }
+}
+
+static std::string _describeStatus(int status) {
+    if (status == -1) {
+        return "";
+    }
+    if (WIFSIGNALED(status)) {
+        return " : killed by signal " + std::to_string(WTERMSIG(status));
+    }
+    return " : exit " + std::to_string(WEXITSTATUS(status));
+}
+
+#define SEQLOCK_SPINS (100) // retries before backing off to 1ms sleeps
+#define SEQLOCK_SLEEPS (1000) // a writer holding the table this long is gone
+
+// false if the table never settled: smash died in the middle of an update
+static bool _printJobs(const char* mapping, const SmashShmHeader* header) {
+    std::vector<SmashShmJob> jobs(header->jobCapacity);
+    uint32_t jobCount;
+    for (int attempt = 0;; ++attempt) { //seqlock reader
+        uint64_t seq = __atomic_load_n(&header->tableSeq, __ATOMIC_ACQUIRE);
+        if (seq % 2 == 0) {
+            for (uint32_t i = 0; i < header->jobCapacity; ++i) {
+                memcpy(&jobs[i], mapping + header->jobsOffset + (uint64_t)i * header->jobSize, sizeof(SmashShmJob));
+            }
+            jobCount = header->jobCount;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&header->tableSeq, __ATOMIC_RELAXED) == seq) {
+                break;
+            }
+        }
+        if (attempt < SEQLOCK_SPINS) {
+            continue;
+        }
+        bool gone = (__atomic_load_n(&header->flags, __ATOMIC_ACQUIRE) & SMASH_SHM_CLOSED) != 0 ||
+                    (kill(header->smashPid, 0) == -1 && errno == ESRCH);
+        if (gone || attempt >= SEQLOCK_SPINS + SEQLOCK_SLEEPS) {
+            fprintf(stderr, "smash_jobs: smash %d left its job table in the middle of an update\n", header->smashPid);
+            return false;
+        }
+        struct timespec delay = {0, 1000000};
+        nanosleep(&delay, nullptr);
+    }
+    time_t now = time(nullptr);
+    uint32_t listed = 0;
+    for (const SmashShmJob& j : jobs) {
+        if (j.jobId == 0) {
+            continue;
+        }
+        listed++;
+        if (j.state == SMASH_JOB_QUEUED) {
+            printf("[%d] %s : queued\n", j.jobId, j.commandLine);
+            continue;
+        }
+        printf("[%d] %s : %d %ld secs%s\n", j.jobId, j.commandLine, j.pid,
+               (long)(now - j.startTimeNs / 1000000000LL), j.state == SMASH_JOB_STOPPED ? " (stopped)" : "");
+    }
+    if (jobCount > listed) {
+        printf("(%u more jobs with ids above %u)\n", jobCount - listed, header->jobCapacity);
+    }
+    return true;
+}
+
+// prints events from *next on, returns false once smash has exited
+static bool _printEvents(const char* mapping, const SmashShmHeader* header, uint64_t* next) {
+    uint64_t count = __atomic_load_n(&header->eventCount, __ATOMIC_ACQUIRE);
+    if (count - *next > header->ringCapacity) {
+        printf("(%llu events lost)\n", (unsigned long long)(count - header->ringCapacity - *next));
+        *next = count - header->ringCapacity;
+    }
+    for (; *next < count; ++*next) {
+        const SmashShmEvent* slot = (const SmashShmEvent*)(mapping + header->ringOffset +
+                                                           (*next % header->ringCapacity) * header->eventSize);
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        SmashShmEvent event;
+        memcpy(&event, slot, sizeof(event));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq != *next + 1 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) { //lapped while copying
+            printf("(event %llu lost)\n", (unsigned long long)*next);
+            continue;
+        }
+        time_t seconds = event.timeNs / 1000000000LL;
+        struct tm local;
+        char when[16];
+        localtime_r(&seconds, &local);
+        strftime(when, sizeof(when), "%H:%M:%S", &local);
+        printf("%s.%03lld %s [%d] %d %s%s\n", when, (long long)(event.timeNs / 1000000 % 1000),
+               _eventName(event.type), event.jobId, event.pid, event.commandLine,
+               event.type == SMASH_EVENT_FINISHED ? _describeStatus(event.status).c_str() : "");
+    }
+    fflush(stdout);
+    return (__atomic_load_n(&header->flags, __ATOMIC_ACQUIRE) & SMASH_SHM_CLOSED) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    bool events = false;
+    bool follow = false;
+    if (argc == 3 && strcmp(argv[1], "-e") == 0) {
+        events = true;
+    } else if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+        events = follow = true;
+    } else if (argc != 2 || argv[1][0] == '-') {
+        fprintf(stderr, "usage: smash_jobs [-e | -f] <smash pid>\n");
+        return 2;
+    }
+    std::string path = std::string("/dev/shm/smash-") + argv[argc - 1];
+    int fd = open(path.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd == -1) {
+        perror(("smash_jobs: " + path + " (is smash running with SMASH_SHM=1?)").c_str());
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SmashShmHeader)) {
+        fprintf(stderr, "smash_jobs: %s is not a smash job table\n", path.c_str());
+        return 1;
+    }
+    void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        perror("smash_jobs: mmap failed");
+        return 1;
+    }
+    const char* mapping = (const char*)m;
+    const SmashShmHeader* header = (const SmashShmHeader*)mapping;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SMASH_SHM_MAGIC ||
+            header->version != SMASH_SHM_VERSION || header->jobSize < sizeof(SmashShmJob) ||
+            header->eventSize < sizeof(SmashShmEvent) || header->ringCapacity == 0 ||
+            header->jobsOffset > (uint64_t)st.st_size || header->ringOffset > (uint64_t)st.st_size ||
+            (uint64_t)header->jobCapacity * header->jobSize > (uint64_t)st.st_size - header->jobsOffset ||
+            (uint64_t)header->ringCapacity * header->eventSize > (uint64_t)st.st_size - header->ringOffset) {
+        fprintf(stderr, "smash_jobs: %s has an unknown layout\n", path.c_str());
+        return 1;
+    }
+    if (!events) {
+        return _printJobs(mapping, header) ? 0 : 1;
+    }
+    uint64_t count = __atomic_load_n(&header->eventCount, __ATOMIC_ACQUIRE);
+    uint64_t next = count > header->ringCapacity ? count - header->ringCapacity : 0; //the oldest still there
+    while (_printEvents(mapping, header, &next) && follow) {
+        struct timespec delay = {0, 100 * 1000000};
+        nanosleep(&delay, nullptr);
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef SMASH_SHM_H_
+#define SMASH_SHM_H_
+
+// Layout of /dev/shm/smash-<pid>, which smash publishes when started with SMASH_SHM=1 so that
+// monitors can follow its jobs without running "jobs" or scanning /proc. smash_jobs.cpp reads it.
+//
+// Version 1, host byte order, every offset relative to the start of the mapping:
+//   SmashShmHeader                      at 0
+//   SmashShmJob[jobCapacity]            at jobsOffset, slot i holds job id i + 1 (jobId 0: free slot)
+//   SmashShmEvent[ringCapacity]         at ringOffset, event n lives in slot n % ringCapacity
+//
+// Job table: a seqlock. tableSeq is odd while smash is writing; read it (acquire), copy what you
+// need, then read it again and retry if it was odd or changed. Jobs with ids above jobCapacity
+// are counted in jobCount but not listed.
+//
+// Event ring: smash is the only writer. eventCount (acquire) is the number of events written so
+// far, each reader keeps its own count of events consumed. Event n is intact if its seq was n + 1
+// both before and after copying it; if eventCount - n > ringCapacity it was already overwritten.
+//
+// Readers must check magic and version, and use headerSize/jobSize/eventSize as strides so that
+// fields appended at the end of a struct don't break them. Anything else bumps the version.
+
+#include <stdint.h>
+
+#define SMASH_SHM_MAGIC (0x48534d53u) // "SMSH"
+#define SMASH_SHM_VERSION (1u)
+#define SMASH_SHM_JOBS (1024u)
+#define SMASH_SHM_EVENTS (1024u) // a power of two
+#define SMASH_SHM_CLOSED (1u) // header flags: smash exited, nothing will change anymore
+
+enum SmashJobState { SMASH_JOB_RUNNING = 1, SMASH_JOB_STOPPED = 2, SMASH_JOB_QUEUED = 3 };
+
+enum SmashEventType {
+    SMASH_EVENT_STARTED = 1,
+    SMASH_EVENT_STOPPED = 2,
+    SMASH_EVENT_RESUMED = 3,
+    SMASH_EVENT_FINISHED = 4, // status: wait status, -1 if smash didn't reap it (fg, ctrl-C)
+    SMASH_EVENT_TIMED_OUT = 5, // jobId 0 for the foreground command
+    SMASH_EVENT_QUEUED = 6,
+    SMASH_EVENT_CANCELLED = 7 // a queued job that never started
+};
+
+struct SmashShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t jobSize;
+    uint32_t eventSize;
+    uint32_t jobCapacity;
+    uint32_t ringCapacity;
+    int32_t smashPid;
+    uint64_t jobsOffset;
+    uint64_t ringOffset;
+    uint64_t tableSeq;
+    uint64_t eventCount;
+    uint32_t jobCount;
+    uint32_t flags;
+    uint8_t reserved[56];
+}; // 128 bytes
+
+struct SmashShmJob {
+    int32_t jobId;
+    int32_t pid; // the job's process group, 0 while queued
+    uint32_t state; // SmashJobState
+    uint32_t reserved;
+    int64_t startTimeNs; // CLOCK_REALTIME
+    char commandLine[104]; // NUL-terminated, cut short if longer
+}; // 128 bytes
+
+struct SmashShmEvent {
+    uint64_t seq; // n + 1 for event n, written last
+    int64_t timeNs; // CLOCK_REALTIME
+    uint32_t type; // SmashEventType
+    int32_t jobId;
+    int32_t pid;
+    int32_t status;
+    char commandLine[96];
+}; // 128 bytes
+
+#endif //SMASH_SHM_H_
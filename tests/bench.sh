@@ -0,0 +1,15 @@
+#!/bin/sh
+# smash_bench's command line; "make bench" itself takes minutes and isn't run here: tests/bench.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+BENCH=$(dirname "$SMASH")/smash_bench
+
+"$BENCH" -x "$SMASH" > output 2>&1
+got=$?
+[ $got = 2 ] && grep -q '^usage: smash_bench \[-q\] \[smash binary\]$' output ||
+    fail "smash_bench -x: exit $got, $(cat output)"
+"$BENCH" -q "$WORK/no_such_smash" > output 2>&1
+got=$?
+[ $got = 1 ] && grep -q 'is not executable, build it first$' output ||
+    fail "smash_bench without a smash: exit $got, $(cat output)"
+
+finish
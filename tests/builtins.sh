@@ -0,0 +1,69 @@
+#!/bin/sh
+# builtins that replace coreutils print what coreutils does: tests/builtins.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+export LC_ALL=C
+printf 'foo bar\n\tbaz  qux\r\nx\0y \001 z\n\200word\nno newline' > text.txt
+awk 'BEGIN { for (i = 0; i < 5000; i++) printf "line %d  of\ttext %c\n", i, 33 + i % 94 }' > long.txt
+: > empty.txt
+head -c 3000000 /dev/urandom > random.bin
+
+# wc, with every kernel: regular files are mapped, stdin and pipes are read
+for kernel in scalar sse2 avx2; do
+    export SMASH_WC_KERNEL=$kernel
+    for options in '' -l -w -c -lw; do
+        expect_same "wc $options text.txt" "wc $options text.txt"
+        expect_same "wc $options long.txt empty.txt text.txt" "wc $options long.txt empty.txt text.txt"
+        expect_same "cat long.txt | wc $options" "cat long.txt | wc $options"
+        expect_same "wc $options < text.txt" "wc $options < text.txt"
+        expect_same "wc $options random.bin" "wc $options random.bin" #every byte value, at every offset
+    done
+done
+unset SMASH_WC_KERNEL
+expect_match '^smash error: open failed' 'wc missing.txt'
+expect 1 'wc missing.txt text.txt'
+
+# fgrep, with every kernel, against grep -F -a: bytes are bytes, there are no binary files
+for kernel in scalar sse2 avx2; do
+    export SMASH_FGREP_KERNEL=$kernel
+    for pattern in line 4999 'of' x no_such_text; do
+        for options in '' -c -l; do
+            expect_same "fgrep $options $pattern long.txt" "grep -F -a $options $pattern long.txt"
+            expect_same "fgrep $options $pattern long.txt text.txt" "grep -F -a $options $pattern long.txt text.txt"
+            expect_same "cat long.txt | fgrep $options $pattern" "cat long.txt | grep -F $options $pattern"
+        done
+    done
+done
+unset SMASH_FGREP_KERNEL
+expect_same 'fgrep newline text.txt' 'grep -F -a newline text.txt'
+# patterns longer than a vector, with first byte == last byte, and runs that nearly match at every offset
+awk 'BEGIN { for (i = 0; i < 3000; i++) { s = ""; for (j = 0; j < i % 70; j++) s = s "a"; print s "b" i "-" s } }' > runs.txt
+for kernel in scalar sse2 avx2; do
+    export SMASH_FGREP_KERNEL=$kernel
+    for pattern in aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa \
+                   ab2999-aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa ab7 b1-a a-a; do
+        expect_same "fgrep -c $pattern runs.txt random.bin" "grep -F -a -c $pattern runs.txt random.bin"
+        expect_same "fgrep $pattern runs.txt" "grep -F -a $pattern runs.txt"
+    done
+done
+unset SMASH_FGREP_KERNEL
+
+# cat: file to pipe is spliced, file to file stays in the kernel, a terminal or /dev/null gets read/write
+for files in text.txt 'long.txt empty.txt text.txt' random.bin 'random.bin random.bin'; do
+    expect_same "cat $files" "cat $files"
+    expect_same "cat $files | cat" "cat $files | cat"
+    expect_same "cat $files > out.bin
+cat out.bin" "cat $files"
+    expect_same "cat < random.bin | cat $files - text.txt" "cat < random.bin | cat $files - text.txt"
+done
+expect_same 'cat < long.txt' 'cat < long.txt'
+expect_same 'cat - < text.txt' 'cat - < text.txt'
+expect 0 'cat random.bin > /dev/null'
+expect 1 'cat text.txt missing.txt'
+cp text.txt same.txt
+expect_match '^smash error: cat: input file is output file$' 'cat same.txt >> same.txt' #as coreutils does
+expect 1 'cat same.txt >> same.txt'
+cmp -s text.txt same.txt || fail "cat same.txt >> same.txt changed it"
+# options it doesn't implement go to the real cat
+expect_same 'cat -n long.txt' 'cat -n long.txt'
+
+finish
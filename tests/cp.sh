@@ -0,0 +1,45 @@
+#!/bin/sh
+# cp and the copy strategies it picks: tests/cp.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+seq 10 > small.txt
+head -c 20000000 /dev/urandom > big.bin
+
+# whatever the strategy, the copy is the same bytes
+expect_match '^smash: cp: [a-z_/]+, 21 bytes' 'cp -v small.txt out.txt'
+cmp -s small.txt out.txt || fail "cp small.txt: copy differs"
+for j in 1 2 4; do
+    expect_match "^smash: cp: [a-z_/]+( x$j)?, 20000000 bytes" "cp -v -j $j big.bin out.bin"
+    cmp -s big.bin out.bin || fail "cp -j $j big.bin: copy differs"
+done
+# parallel ranges: sizes that don't split evenly, more workers than 1 MiB units, and a longer
+# destination that must end up cut to the source's size
+head -c 3145729 big.bin > odd.bin
+for j in 3 8; do
+    expect 0 "cp -j $j odd.bin out.bin"
+    cmp -s odd.bin out.bin || fail "cp -j $j odd.bin: copy differs"
+    expect 0 "cp -j $j small.txt out.txt"
+    cmp -s small.txt out.txt || fail "cp -j $j small.txt: copy differs"
+done
+cp big.bin long.bin
+expect 0 'cp -j 4 odd.bin long.bin'
+cmp -s odd.bin long.bin || fail "cp -j 4 over a longer file: copy differs"
+expect_match '^smash: cp: read/write, ' 'cp -v /proc/self/status out.txt' #size 0, can only be streamed
+expect 0 'cp small.txt small.txt'
+
+# failures exit 1
+expect 1 'cp missing.txt out.txt'
+expect 1 'cp small.txt no_such_dir/out.txt'
+expect 1 'cp small.txt'
+expect 1 'cp -j 0 small.txt out.txt'
+# sysfs files claim 4096 bytes and hold fewer: a source shorter than its size, to the parallel copy
+if [ -r /sys/kernel/mm/transparent_hugepage/enabled ]; then
+    expect_match 'source file shrank' 'cp -j 2 /sys/kernel/mm/transparent_hugepage/enabled out.txt'
+    expect 1 'cp -j 2 /sys/kernel/mm/transparent_hugepage/enabled out.txt'
+fi
+
+# ">>" targets are O_APPEND, which reflinks and copy_file_range refuse
+expect 0 'cat small.txt >> appended.txt
+cat small.txt >> appended.txt'
+[ "$(wc -l < appended.txt)" = 20 ] || fail "cat >> twice: $(wc -l < appended.txt) lines, expected 20"
+
+finish
@@ -0,0 +1,80 @@
+#!/bin/sh
+# how external commands are started: tests/exec.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+printf 'echo from-script\n' > noshebang.sh
+printf 'x\n' > noexec.txt
+chmod +x noshebang.sh
+mkdir dir
+
+# plain "prog arg..." is exec'd directly, anything bash would interpret goes through bash -c
+export SMASH_TRACE=1 #commands that print nothing, their output could land inside a trace line
+expect_match '^smash: exec \(direct, direct=1 bash=0\): true hi$' 'true hi'
+expect_match '^smash: exec \(bash, direct=0 bash=1\): true \$HOME$' 'true $HOME'
+expect_match '^smash: exec \(bash, direct=0 bash=1\): true "a  b"$' 'true "a  b"'
+expect_match '^smash: exec \(bash, direct=0 bash=1\): true \*$' 'true *'
+# the counters are shared with the forked children, so they add up across commands
+expect_match 'direct=2 bash=1\): true$' 'true
+true $HOME
+true'
+unset SMASH_TRACE
+
+# the direct path behaves like bash would have, launched with posix_spawn (the default) or fork+exec
+for spawn in 1 0; do
+    export SMASH_SPAWN=$spawn
+    expect_output 'a b' 'echo a    b'
+    expect_output 'a  b' 'echo "a  b"'
+    expect_output 'from-script' './noshebang.sh' #no #!: exec fails with ENOEXEC, bash runs it
+    expect 0 './noshebang.sh'
+    expect 7 'sh -c "exit 7"'
+    expect 126 './noexec.txt'
+    expect 126 './dir'
+    expect 127 'no_such_command_for_smash'
+    # redirected, as a pipeline stage and in the background
+    expect_output 'hi' 'echo hi > out.txt
+cat out.txt'
+    expect_output '3' 'printf "a\nb\nc\n" | cat | wc -l'
+    expect_match '^\[1\] sleep 0.1 & : [0-9]+ .*exit status 0' 'sleep 0.1 &
+sleep 0.3
+jobs -v'
+done
+# each path reports its own failure
+export SMASH_SPAWN=1
+expect_match '^smash error: posix_spawn failed: Permission denied$' './dir'
+export SMASH_SPAWN=0
+expect_match '^smash error: execv failed: Permission denied$' './dir'
+unset SMASH_SPAWN
+
+# PATH lookups are cached per name, "hash" lists them by name with their hits
+mkdir b1 b2
+printf '#!/bin/sh\necho one\n' > b1/tool
+printf '#!/bin/sh\necho two\n' > b2/tool
+chmod +x b1/tool b2/tool
+export PATH="$WORK/b1:$WORK/b2:$PATH"
+expect_same 'tool
+tool
+hash' "echo one; echo one; printf 'hits\\tcommand\\n   2\\t$WORK/b1/tool\\n'"
+# a cached binary that disappeared is looked up again
+expect_same 'tool
+rm b1/tool
+tool
+hash' "echo one; echo two; printf 'hits\\tcommand\\n   1\\t%s\\n   1\\t$WORK/b2/tool\\n' \"$(command -v rm)\""
+expect_output 'two
+smash: hash table empty' 'tool
+hash -r
+hash'
+expect_output "smash: hash table empty
+hits	command
+   1	$WORK/b2/tool" 'hash
+hash tool
+hash'
+expect_match '^smash error: hash: no_such_command_for_smash: not found$' 'hash no_such_command_for_smash'
+# relative PATH entries depend on the cwd, so they are never cached
+cp b2/tool here
+saved=$PATH
+PATH=".:$PATH"
+expect_output 'two
+smash: hash table empty' 'here
+hash'
+PATH=$saved
+
+finish
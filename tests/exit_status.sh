@@ -0,0 +1,71 @@
+#!/bin/sh
+# batch mode (smash -c, smash <script>): exit statuses and output: tests/exit_status.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+printf 'foo\nbar\n' > in.txt
+
+# fgrep, in process and as a forked pipeline stage
+expect 0 'fgrep foo in.txt'
+expect 1 'fgrep zzz in.txt'
+expect 1 'fgrep zzz < in.txt'
+expect 2 'fgrep foo missing.txt'
+expect 0 'echo foo | fgrep foo'
+expect 1 'echo foo | fgrep zzz'
+expect 1 'cat in.txt | fgrep -c zzz'
+expect 1 'echo foo | fgrep zzz > out.txt'
+expect 0 'echo foo | fgrep zzz | cat'
+# a forked builtin doesn't inherit the previous command's status
+expect 0 '/bin/false
+cat in.txt | cat'
+
+# batch mode exits with the last command's status
+expect 1 '/bin/false'
+expect 0 '/bin/false
+/bin/true'
+expect 3 'sh -c "exit 3"'
+expect 127 'no_such_command_for_smash'
+expect_script 1 '/bin/false'
+expect_script 0 'fgrep foo in.txt
+/bin/true'
+expect_script 1 'echo foo
+echo foo | fgrep zzz'
+expect_script 0 'fgrep zzz in.txt
+echo foo | fgrep foo'
+expect_script 2 'cat in.txt | fgrep foo missing.txt'
+
+# quit exits with the status of the command before it, and nothing after it runs
+expect 1 '/bin/false
+quit'
+expect 3 'sh -c "exit 3"
+quit kill'
+expect 0 '/bin/false
+/bin/true
+quit'
+expect_script 1 '/bin/false
+quit
+/bin/true'
+expect_output 'foo' 'echo foo
+quit
+echo bar'
+
+# smash's usage: a missing script, bad arguments
+"$SMASH" missing.smash > /dev/null 2>&1
+got=$?
+[ $got = 1 ] || fail "smash missing.smash: exit $got, expected 1"
+"$SMASH" -x > /dev/null 2>&1
+got=$?
+[ $got = 2 ] || fail "smash -x: exit $got, expected 2"
+
+# builtin output is buffered in batch mode, but stays in order with what children write
+printf '%s\n' 'chprompt x' 'pwd' 'echo external' 'showpid' '/bin/echo direct' 'jobs' 'cat in.txt' \
+    'echo foo | fgrep foo' 'wc -l in.txt' > order.smash
+"$SMASH" order.smash > got 2>&1
+printf '%s\n' "$PWD" external "smash pid is PID" direct foo bar foo '2 in.txt' > want
+sed -E 's/^smash pid is [0-9]+$/smash pid is PID/' got > got.short
+cmp -s got.short want || fail "batch output order:$(diff got.short want | head -n 6)"
+# and nothing is lost when the output is a pipe that is read slowly
+"$SMASH" -c 'seq 20000
+cat in.txt
+seq 3' | (sleep 0.3; cat) > got
+[ "$(wc -l < got)" = 20005 ] && [ "$(tail -n 1 got)" = 3 ] || fail "batch output to a slow pipe: $(wc -l < got) lines"
+
+finish
@@ -0,0 +1,29 @@
+#!/bin/sh
+# smash reading commands from stdin, where the event loop waits on input, signals, children and timers
+# at once: tests/interactive.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+
+# interactive <file> <sh commands writing smash's input>: smash's output, prompts removed
+interactive() {
+    sh -c "$2" | "$SMASH" 2>&1 | sed 's/smash> //g' > "$1"
+}
+
+# a timer fires while smash waits for the next line, not once it arrives
+interactive got 'echo "timeout 0.1 sleep 5 &"; sleep 0.5; echo "echo after"'
+printf '%s\n' 'smash: got an alarm' 'smash: timeout 0.1 sleep 5 & timed out!' 'after' > want
+cmp -s got want || fail "timer while idle:$(diff got want | head -n 6)"
+
+# so does a signal, and a child exiting is reaped without a command to trigger it
+interactive got 'echo "sh -c \"sleep 0.2; kill -INT \\\$PPID; kill -TSTP \\\$PPID\" &"; sleep 0.6; echo "echo after"
+echo "jobs -v"'
+sed -E 's/ : [0-9]+ done.*/ : done/' got > got.short
+printf '%s\n' 'smash: got ctrl-C' 'smash: got ctrl-Z' 'after' \
+    '[1] sh -c "sleep 0.2; kill -INT \$PPID; kill -TSTP \$PPID" & : done' > want
+cmp -s got.short want || fail "signals while idle:$(diff got.short want | head -n 6)"
+
+# a line may arrive in pieces, and the last one needs no newline
+interactive got 'printf "echo a\necho b"; sleep 0.2; printf "c\necho d"'
+printf '%s\n' a bc d > want
+cmp -s got want || fail "split input:$(diff got want | head -n 6)"
+
+finish
@@ -0,0 +1,128 @@
+#!/bin/sh
+# background jobs and the job table: tests/jobs.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+printf 'foo\nbar\n' > in.txt
+
+# in-process builtins still become jobs when asked to; jobs -v lists them even once finished
+expect_match '^\[1\] cat in.txt > out.txt & : [0-9]+ ' 'cat in.txt > out.txt &
+jobs -v'
+expect_match '^\[1\] wc in.txt & : [0-9]+ ' 'wc in.txt &
+jobs -v'
+expect_match '^\[1\] fgrep foo in.txt & : [0-9]+ ' 'fgrep foo in.txt &
+jobs -v'
+
+# every child is reaped as it exits, with its own status, and none is left a zombie
+script=''
+for i in $(seq 100); do
+    script="$script
+sh -c \"exit $((i % 5))\" &"
+done
+"$SMASH" -c "$script
+sleep 1
+jobs
+jobs -v
+sh -c \"ps -o stat= --ppid \\\$PPID\"" > output 2>&1
+[ "$(grep -c ' done, exit status ' output)" = 64 ] || fail "100 finished jobs: jobs -v kept $(grep -c ' done, ' output), expected 64"
+! grep -q '^Z' output || fail "100 finished jobs: zombies left behind"
+grep -Ev '^\[[0-9]+\] sh -c "exit ([0-4])" & : [0-9]+ done, exit status \1 |^[A-Z]+$' output > other
+[ ! -s other ] || fail "100 finished jobs, unexpected: $(head -n 3 other)"
+# ids are free again once the jobs are gone
+expect_match '^\[1\] sleep 1 & : ' 'sh -c "exit 1" &
+sleep 0.2
+sleep 1 &
+jobs'
+expect_match '^\[2\] sleep 1 & : .*killed by signal 9' 'sleep 1 &
+sleep 1 &
+kill -9 2
+sleep 0.2
+jobs -v'
+
+# the table: listed by id, a new job takes max id + 1, ids are looked up directly
+"$SMASH" -c 'sleep 5 &
+sleep 5 &
+sleep 5 &
+kill -9 2
+sleep 0.1
+jobs
+sleep 5 &
+jobs
+kill -9 4
+kill -9 3
+sleep 0.1
+sleep 5 &
+jobs
+kill -9 7
+fg 7
+bg 1
+kill -9 1
+kill -9 2' > output 2> errors
+sed -E 's/ : [0-9]+ [0-9]+ secs$//; s/pid [0-9]+$/pid/' output > got
+printf '%s\n' 'signal number 9 was sent to pid' '[1] sleep 5 &' '[3] sleep 5 &' '[1] sleep 5 &' '[3] sleep 5 &' \
+    '[4] sleep 5 &' 'signal number 9 was sent to pid' 'signal number 9 was sent to pid' '[1] sleep 5 &' \
+    '[2] sleep 5 &' 'signal number 9 was sent to pid' 'signal number 9 was sent to pid' > want
+cmp -s got want || fail "job table listing:$(diff got want | head -n 6)"
+printf '%s\n' 'smash error: kill: job-id 7 does not exist' 'smash error: fg: job-id 7 does not exist' \
+    'smash error: bg: job-id 1 is already running in the background' > want
+cmp -s errors want || fail "job table errors:$(diff errors want | head -n 6)"
+
+# and it holds many jobs at once
+script=''
+for i in $(seq 500); do
+    script="$script
+sleep 5 &"
+done
+"$SMASH" -c "$script
+kill -9 250
+sleep 0.2
+jobs
+quit kill" > output 2>&1
+[ "$(grep -c '^\[[0-9]*\] sleep 5 & : ' output)" = 499 ] || fail "500 jobs: listed $(grep -c '^\[' output), expected 499"
+grep -q '^\[250\]' output && fail "500 jobs: killed job 250 still listed"
+grep -q '^\[500\] sleep 5 & : ' output || fail "500 jobs: job 500 not listed"
+grep -q '^smash: sending SIGKILL signal to 499 jobs:$' output || fail "500 jobs: quit kill didn't find 499 jobs"
+
+# jobslimit: background jobs past the limit wait in the table as queued, and start in order as
+# slots free up between commands
+expect_output 'smash: jobs limit is unlimited (0 running, 0 queued)
+smash: jobs limit is 1 (1 running, 2 queued)' 'jobslimit
+jobslimit 1
+sleep 0.3 &
+true &
+true &
+jobslimit'
+"$SMASH" -c 'jobslimit 1
+sleep 0.3 &
+sh -c "echo b >> order.txt" &
+sh -c "echo c >> order.txt" &
+jobs
+sleep 0.5
+jobs -v' > output 2>&1
+grep -Eq '^\[2\] sh -c "echo b >> order.txt" & : queued$' output || fail "jobslimit 1, job 2 not queued: $(cat output)"
+grep -Eq '^\[3\] sh -c "echo c >> order.txt" & : queued$' output || fail "jobslimit 1, job 3 not queued: $(cat output)"
+# smash doesn't exit while jobs are queued: input ended, so it waits for slots and starts them. It
+# doesn't wait for the last one to finish, so give that a moment
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ "$(wc -l < order.txt 2>/dev/null)" = 2 ] && break
+    sleep 0.1
+done
+[ "$(cat order.txt 2>/dev/null)" = "$(printf 'b\nc')" ] || fail "jobslimit 1, queued jobs ran as '$(cat order.txt)'"
+# a higher limit starts them at once, kill cancels one, fg and bg start it now
+expect_match '^\[2\] echo x & : [0-9]+ ' 'jobslimit 1
+sleep 0.3 &
+echo x &
+jobslimit 2
+jobs'
+expect_match '^smash: queued job 2 was cancelled$' 'jobslimit 1
+sleep 0.3 &
+echo x &
+kill -9 2'
+expect_output 'echo x
+x' 'jobslimit 1
+sleep 0.3 &
+echo x &
+fg 2'
+for bad in 'jobslimit -1' 'jobslimit x' 'jobslimit 1 2'; do
+    expect_match '^smash error: jobslimit: invalid arguments$' "$bad"
+done
+
+finish
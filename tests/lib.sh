@@ -0,0 +1,54 @@
+# sourced by every tests/*.sh: each runs as tests/<name>.sh [smash binary], from a scratch directory
+SMASH=$(cd "$(dirname "${1:-./smash}")" && pwd)/$(basename "${1:-./smash}")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+failures=0
+
+fail() {
+    echo "FAIL ($(basename "$0")): $*"
+    failures=$((failures + 1))
+}
+
+# expect <status> <commands>: run them with smash -c
+expect() {
+    "$SMASH" -c "$2" > /dev/null 2>&1
+    got=$?
+    [ "$got" = "$1" ] || fail "smash -c '$2' exited $got, expected $1"
+}
+
+# expect_script <status> <script>: run it from a file, smash <script>
+expect_script() {
+    printf '%s\n' "$2" > "$WORK/script.smash"
+    "$SMASH" "$WORK/script.smash" > /dev/null 2>&1
+    got=$?
+    [ "$got" = "$1" ] || fail "smash <script> exited $got, expected $1, script: $2"
+}
+
+# expect_output <stdout> <commands>: exactly that on stdout
+expect_output() {
+    got=$("$SMASH" -c "$2" 2> /dev/null)
+    [ "$got" = "$1" ] || fail "smash -c '$2' printed '$got', expected '$1'"
+}
+
+# expect_match <extended regex> <commands>: some line of stdout and stderr matches
+expect_match() {
+    "$SMASH" -c "$2" > "$WORK/output" 2>&1
+    grep -Eq -- "$1" "$WORK/output" || fail "smash -c '$2' printed '$(cat "$WORK/output")', expected /$1/"
+}
+
+# expect_same <commands> <sh commands>: smash prints what sh does, stdout and stderr
+expect_same() {
+    "$SMASH" -c "$1" > "$WORK/got" 2>&1
+    sh -c "$2" > "$WORK/want" 2>&1
+    cmp -s "$WORK/got" "$WORK/want" ||
+        fail "smash -c '$1' differs from sh -c '$2':$(diff "$WORK/got" "$WORK/want" | head -n 6)"
+}
+
+finish() {
+    if [ "$failures" -ne 0 ]; then
+        echo "$(basename "$0"): $failures failed"
+        exit 1
+    fi
+    echo "$(basename "$0"): all passed"
+}
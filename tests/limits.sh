@@ -0,0 +1,40 @@
+#!/bin/sh
+# limit [--mem size] [--cpu secs] [--nofile n] [--cpus n] <command>: tests/limits.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+nofile=$(sh -c 'ulimit -n')
+
+# the rlimits hold in the command, and only in it
+expect_output '10' 'limit --nofile 10 sh -c "ulimit -n"'
+expect_output '1' 'limit --cpu 1 sh -c "ulimit -t"'
+expect_output "10
+$nofile" 'limit --nofile 10 sh -c "ulimit -n"
+sh -c "ulimit -n"'
+# --mem and --cpus go to a cgroup of the job's own where one can be made; without one, --mem is an
+# address space limit
+"$SMASH" -c 'limit --mem 64M --cpus 0.5 sleep 0.3 &
+jobs' > output 2>&1
+if grep -q ', no cgroup\]$' output; then
+    expect_output '65536' 'limit --mem 64M sh -c "ulimit -v"'
+else
+    grep -Eq '\[mem 64M, cpus 0.5, cgroup memory.max 67108864 cpu.max 50000 100000\]$' output ||
+        fail "limit --mem --cpus in a cgroup: $(cat output)"
+fi
+# a builtin under a limit is forked, so smash itself keeps its own
+expect_output "hi
+$nofile" 'echo hi > in.txt
+limit --nofile 5 cat in.txt
+sh -c "ulimit -n"'
+
+# running out is reported with the limit that did it, and the job table shows a job's limits
+expect_match '^smash: sh -c "while :; do :; done" was killed by its CPU time limit \(1s\)$' \
+    'limit --cpu 1 sh -c "while :; do :; done"'
+expect 152 'limit --cpu 1 sh -c "while :; do :; done"'
+expect_match '^\[1\] sleep 0.3 & : [0-9]+ [0-9]+ secs \[nofile 20\]$' 'limit --nofile 20 sleep 0.3 &
+jobs'
+
+for bad in 'limit true' 'limit --cpu -1 true' 'limit --cpu x true' 'limit --mem 1Q true' 'limit --bogus 1 true' \
+           'limit --nofile 10'; do
+    expect_match '^smash error: limit: invalid arguments$' "$bad"
+done
+
+finish
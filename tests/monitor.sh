@@ -0,0 +1,28 @@
+#!/bin/sh
+# per-job resource sampling, jobs -l and jtop: tests/monitor.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+sample='\[([0-9]+) procs, ([0-9]+) threads, cpu ([0-9.]+)%, rss ([0-9]+)KB, read ([0-9]+)B, write ([0-9]+)B\]$'
+
+# every process of the job's group is counted, a busy one shows its cpu
+"$SMASH" -c 'sh -c "while :; do :; done" &
+sleep 5 | sleep 5 | sleep 5 &
+sleep 0.3
+jobs -l
+jtop -d 0.3 -n 2
+kill -9 1
+kill -9 2' > output 2>&1
+grep -Eq "^\[1\] sh -c \"while :; do :; done\" & : [0-9]+ [0-9]+ secs $sample" output || fail "jobs -l: $(head -n 2 output)"
+grep -Eq "^\[2\] sleep 5 \| sleep 5 \| sleep 5 & : [0-9]+ [0-9]+ secs \[3 procs, 3 threads, " output ||
+    fail "jobs -l, a pipeline: $(head -n 2 output)"
+# the last sample of the busy job covers 0.3s of spinning
+cpu=$(grep '^\[1\]' output | tail -n 1 | sed -E "s/.*$sample/\3/")
+[ "${cpu%.*}" -ge 10 ] || fail "jtop: a busy loop at ${cpu}% cpu"
+[ "$(grep -c '^\[1\]' output)" = 3 ] || fail "jobs -l then jtop -n 2: $(grep -c '^\[1\]' output) samples of job 1"
+
+expect_output '' 'jobs -l'
+expect_output '' 'jtop -n 1'
+for bad in 'jtop x' 'jtop -d' 'jtop -d x' 'jtop -n -1' 'jtop -d 0'; do
+    expect_match '^smash error: jtop: invalid arguments$' "$bad"
+done
+
+finish
@@ -0,0 +1,37 @@
+#!/bin/sh
+# parallel [-j N] [-k] [-a file] <command> [::: items]: tests/parallel.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+printf 'x\ny\n\n' > items.txt
+
+# {} is replaced by the item, or the item is appended; -k prints in item order, not finish order
+expect_output '1
+2
+3' 'parallel -k -j 3 sh -c "sleep 0.\$((3 - {})); echo {}" ::: 1 2 3'
+expect_output '3
+2
+1' 'parallel -j 3 sh -c "sleep 0.\$((3 - {})); echo {}" ::: 1 2 3'
+expect_output 'item x
+item y' 'parallel -k -a items.txt echo item'
+expect_output 'in a
+in b' 'parallel -k echo in
+a
+b' #the rest of the input
+expect_output 'a-a' 'parallel echo {}-{} ::: a'
+
+# at most N run at once: 4 items of 0.3s in two rounds
+start=$(date +%s%N)
+expect 0 'parallel -j 2 sleep ::: 0.3 0.3 0.3 0.3'
+ms=$((($(date +%s%N) - start) / 1000000))
+[ "$ms" -ge 550 ] && [ "$ms" -lt 1100 ] || fail "parallel -j 2, 4 x 0.3s took ${ms}ms"
+# the status is the number of items that failed
+expect 2 'parallel -j 2 sh -c "exit {}" ::: 0 1 2 0'
+# workers are ordinary jobs
+expect_match '^\[1\] sleep 0.1 & : [0-9]+ done, exit status 0 ' 'parallel sleep ::: 0.1
+jobs -v'
+
+for bad in 'parallel -j 0 echo ::: a' 'parallel -j x echo ::: a' 'parallel -x echo ::: a' 'parallel ::: a'; do
+    expect_match '^smash error: parallel: invalid arguments$' "$bad"
+done
+expect_match '^smash error: open failed' 'parallel -a missing.txt echo'
+
+finish
@@ -0,0 +1,46 @@
+#!/bin/sh
+# splitting command lines into words, pipes and redirections: tests/parse.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+
+# no length or word-count limits: a 1 MB word for an in-process builtin, 100 KB words (the kernel's
+# limit for one argument) for an exec'd program, and 20000 words, all from a script file
+long=$(head -c 1000000 /dev/zero | tr '\0' a)
+word=$(head -c 100000 /dev/zero | tr '\0' b)
+printf '%s\n' "$long" > long.txt
+printf 'fgrep -c %s long.txt\n/bin/echo %s %s %s\n' "$long" "$word" "$word" "$word" > long.smash
+"$SMASH" long.smash > got 2>&1
+printf '1\n%s %s %s\n' "$word" "$word" "$word" > want
+cmp -s got want || fail "long words: $(head -c 100 got)"
+words=$(seq 20000 | tr '\n' ' ')
+printf '/bin/echo %s\nwc %s\n' "$words" "$words" > many.smash
+"$SMASH" many.smash > got 2>&1
+[ "$(head -n 1 got | wc -w)" = 20000 ] || fail "20000 words: echo got $(head -n 1 got | wc -w)"
+[ "$(grep -c 'No such file or directory' got)" = 20000 ] || fail "20000 words: wc opened $(grep -c 'No such' got)"
+
+# whitespace: tabs, runs of blanks and a spaced-out background sign
+expect_output 'tab sep' 'echo	tab	sep   '
+expect_output "$PWD" '   pwd   '
+expect_match '^\[1\] sleep 0.1 +& +: ' 'sleep 0.1    &   
+jobs'
+
+# redirections with and without blanks, appending, a quoted target
+expect_output 'hi
+ho' 'echo hi>o1
+echo ho   >>   o1
+cat o1'
+expect_output 'q' 'echo q > "o 2"
+cat "o 2"'
+expect_output 'x' 'echo x >'"'o 3'"'
+cat "o 3"'
+# quoted or escaped operators are just characters
+expect_output 'a > b' 'echo "a > b"'
+expect_output 'a>b' 'echo a\>b'
+expect_output 'a|b' "echo 'a|b' | cat"
+expect_output 'x|{y}' 'echo "x|{y}"'
+expect_output 'h|i' 'echo "h|i" | fgrep "h|i"'
+expect_output 'a;b
+a;b' 'echo "a;b" |{ cat > c1 ; fgrep ";" > c2 }
+cat c1 c2'
+[ ! -e o ] && [ ! -e b ] || fail "a quoted > created a file"
+
+finish
@@ -0,0 +1,45 @@
+#!/bin/sh
+# pipelines and |{ } fan-out: tests/pipes.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+seq 200000 > big.txt
+
+# N stages, builtins and external programs mixed
+expect_same 'cat big.txt | fgrep 7 | sort -r | head -3' 'cat big.txt | grep -F 7 | sort -r | head -3'
+expect_same 'seq 5 | cat | cat | cat | wc -l' 'seq 5 | wc -l'
+expect 1 'seq 5 | cat | fgrep zzz'
+expect_output '1
+2
+3' 'seq 3 |cat|cat'
+# the status is the last stage's
+expect 1 'seq 3 | /bin/false'
+expect 0 '/bin/false | cat'
+# every stage is a child of smash itself, not of the stage before it
+expect_output '1' 'sh -c "echo \$PPID" | sh -c "cat; echo \$PPID" | sh -c "cat; echo \$PPID" | uniq | wc -l'
+# |& sends stderr down the pipe as well
+expect_output '1' 'ls no_such_file_for_smash |& wc -l'
+# a whole pipeline is one job, and SMASH_PIPE_SIZE only changes the buffering
+expect_match '^\[1\] seq 3 \| cat > out.txt & : [0-9]+ ' 'seq 3 | cat > out.txt &
+jobs -v'
+export SMASH_PIPE_SIZE=1048576
+expect_same 'cat big.txt | cat | wc -c' 'wc -c < big.txt'
+unset SMASH_PIPE_SIZE
+
+# every consumer gets the whole stream; each writes its own file, the order they finish in is free
+"$SMASH" -c 'cat big.txt |{ wc -l > a.txt ; fgrep -c 9 > b.txt ; cat > c.txt }' > /dev/null 2>&1
+[ "$(cat a.txt)" = 200000 ] || fail "fan-out: wc -l printed '$(cat a.txt)'"
+[ "$(cat b.txt)" = "$(grep -c 9 big.txt)" ] || fail "fan-out: fgrep -c printed '$(cat b.txt)'"
+cmp -s c.txt big.txt || fail "fan-out: cat copied a different stream"
+
+# a consumer that exits early doesn't cut the others off
+for order in 'head -1 > a.txt ; wc -l > b.txt' 'wc -l > b.txt ; head -1 > a.txt' \
+             'head -1 > a.txt ; head -2 > c.txt ; wc -l > b.txt'; do
+    rm -f a.txt b.txt
+    "$SMASH" -c "cat big.txt |{ $order }" > /dev/null 2>&1
+    [ "$(cat a.txt)" = 1 ] && [ "$(cat b.txt)" = 200000 ] ||
+        fail "fan-out '$order': head -1 printed '$(cat a.txt)', wc -l printed '$(cat b.txt)'"
+done
+# and once every consumer is gone the producer is stopped, not drained forever
+expect_output 'y
+y' 'yes |{ head -1 ; head -1 }'
+
+finish
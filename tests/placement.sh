@@ -0,0 +1,35 @@
+#!/bin/sh
+# pin <cpu list> <command> and the placement policy: tests/placement.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+allowed=$(taskset -pc $$ | sed 's/.*: //')
+first=$(echo "$allowed" | sed 's/[-,].*//')
+
+# the command runs on the cpus asked for (those of them smash may use), smash keeps its own
+expect_output "$first" "pin $first sh -c \"taskset -pc \\\$\\\$ | sed 's/.*: //'\""
+expect_output "$first
+$allowed" "pin $first,1000 sh -c \"taskset -pc \\\$\\\$ | sed 's/.*: //'\"
+sh -c \"taskset -pc \\\$PPID | sed 's/.*: //'\""
+# builtins and redirections under pin still work
+expect_output 'hi' "pin $first echo hi > out.txt
+cat out.txt"
+expect_match '^smash error: pin: none of cpus 1000 are available$' 'pin 1000 true'
+for bad in 'pin x true' 'pin 0' 'pin 3-1 true' 'pin'; do
+    expect_match '^smash error: pin: invalid arguments$' "$bad"
+done
+
+# placement: off by default; cores puts each job on a single cpu, nodes on one node's cpus
+expect_match "^smash: placement is off \\(cpus $allowed, [0-9]+ nodes\\)$" 'placement'
+expect_match '^smash: placement is cores ' 'placement cores
+placement'
+"$SMASH" -c 'placement cores
+sleep 0.3 &
+sleep 0.3 &
+jobs -v' > output 2>&1
+[ "$(grep -Ec '^\[[12]\] sleep 0.3 & : [0-9]+ [0-9]+ secs \[cpus [0-9]+\]$' output)" = 2 ] ||
+    fail "placement cores: $(cat output)"
+expect_match '^\[1\] sleep 0.3 & : [0-9]+ [0-9]+ secs \[cpus [0-9,-]+\]$' 'placement nodes
+sleep 0.3 &
+jobs -v'
+expect_match '^smash error: placement: invalid arguments$' 'placement bogus'
+
+finish
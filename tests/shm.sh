@@ -0,0 +1,35 @@
+#!/bin/sh
+# the job table smash publishes with SMASH_SHM=1, read back by smash_jobs: tests/shm.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+READER=$(dirname "$SMASH")/smash_jobs
+export SMASH_SHM=1
+
+# a monitor started by smash finds it as its parent; the file is smash's alone
+expect_output '600' 'sh -c "stat -c %a /dev/shm/smash-\$PPID"'
+expect_match '^\[1\] sleep 2 & : [0-9]+ ' "sleep 2 &
+sh -c \"$READER \$PPID\""
+expect_match '^\[2\] sleep 3 & : [0-9]+ ' "sleep 2 &
+sleep 3 &
+sh -c \"$READER \$PPID\""
+# and it is gone once smash exits
+pid=$("$SMASH" -c 'sh -c "echo \$PPID"')
+[ ! -e "/dev/shm/smash-$pid" ] || fail "/dev/shm/smash-$pid left behind"
+
+# the event ring: every start, queueing, finish and cancellation, with statuses, in order
+"$SMASH" -c "sleep 0.1 &
+sh -c \"exit 3\" &
+sleep 0.3
+jobslimit 1
+sleep 1 &
+true &
+kill -9 2
+sh -c \"$READER -e \\\$PPID\"
+kill -9 1" > output 2>&1
+sed -E 's/^[0-9:.]+ //; s/\] [0-9]+ /] PID /' output | grep -v '^signal number' > got
+printf '%s\n' 'smash: queued job 2 was cancelled' 'started [1] PID sleep 0.1 &' \
+    'started [2] PID sh -c "exit 3" &' 'finished [2] PID sh -c "exit 3" & : exit 3' \
+    'finished [1] PID sleep 0.1 & : exit 0' 'started [1] PID sleep 1 &' 'queued [2] PID true &' \
+    'cancelled [2] PID true &' > want
+cmp -s got want || fail "smash_jobs -e:$(diff got want | head -n 6)"
+
+finish
@@ -0,0 +1,54 @@
+#!/bin/sh
+# per-phase latency stats and the stats builtin: tests/stats.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+row() { # row <phase or command> <count>: a stats table row with that count
+    echo "^$1 +$2 +[0-9.]+(ns|us|ms|s) "
+}
+
+# off unless asked for, and then nothing is timed
+expect_match '^smash: stats are off, exec: direct 0 bash 0$' 'stats'
+expect_match "$(row command 0)" 'true
+stats'
+
+# each command is timed as a whole and per phase, and counted under its name; "stats on" started
+# untimed, so it isn't in there
+"$SMASH" -c 'stats on
+true
+true
+echo "x y"
+stats' > output 2>&1
+for expected in '^smash: stats are on, exec: direct 2 bash 1$' "$(row command 3)" "$(row launch 3)" \
+        "$(row wait 3)" "$(row true 2)" "$(row echo 1)"; do
+    grep -Eq -- "$expected" output || fail "stats after 3 commands, no /$expected/ in: $(cat output)"
+done
+# reset drops what came before it, off stops counting after itself
+expect_match "$(row true 1)" 'stats on
+true
+stats reset
+true
+stats'
+expect_match "$(row true 1)" 'stats on
+true
+stats off
+true
+stats'
+export SMASH_STATS=1
+expect_match '^smash: stats are on, ' 'stats'
+unset SMASH_STATS
+
+# stats -j, and SMASH_STATS_JSON written when smash exits
+expect_match '^\{"enabled": true, "exec": \{"direct": 1, "bash": 0\}, "phases": \{"command": \{"count": 1, ' 'stats on
+true
+stats -j'
+export SMASH_STATS_JSON="$WORK/stats.json"
+expect 0 'true'
+unset SMASH_STATS_JSON
+grep -q '"commands": {"true": {"count": 1, ' stats.json || fail "SMASH_STATS_JSON: $(cat stats.json)"
+if command -v python3 > /dev/null; then
+    python3 -c 'import json, sys; json.load(open(sys.argv[1]))' stats.json || fail "SMASH_STATS_JSON isn't JSON"
+fi
+
+expect_match '^smash error: stats: invalid arguments$' 'stats x'
+expect_match '^smash error: stats: invalid arguments$' 'stats on off'
+
+finish
@@ -0,0 +1,19 @@
+#!/bin/sh
+# the time prefix: tests/time.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+usage='real [0-9.]+s user [0-9.]+s sys [0-9.]+s maxrss [0-9]+KB faults [0-9]+/[0-9]+ csw [0-9]+/[0-9]+ io [0-9]+/[0-9]+$'
+
+expect_match "^$usage" 'time /bin/true'
+expect_match "^$usage" 'time cat /dev/null' #a builtin, measured on smash
+expect_match "^$usage" 'time seq 1000 | wc -l'
+expect 3 'time sh -c "exit 3"'
+expect_output '' 'time sleep 1 &' #still running, nothing to report yet
+
+# a job stopped by ctrl-Z or killed by ctrl-C was never reaped: no usage, and not smash's own either
+expect_match '^real [0-9.]+s stopped$' 'sh -c "sleep 0.3; kill -TSTP \$PPID" &
+time sleep 2
+kill -9 2'
+expect_match '^real [0-9.]+s killed$' 'sh -c "sleep 0.3; kill -INT \$PPID" &
+time sleep 2'
+
+finish
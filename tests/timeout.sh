@@ -0,0 +1,43 @@
+#!/bin/sh
+# the timeout prefix: tests/timeout.sh [smash binary]
+. "$(dirname "$0")/lib.sh"
+
+# milliseconds count: each command is killed when due, not on the next whole second
+elapsed() { # elapsed <commands>: wall time of smash -c, in ms
+    start=$(date +%s%N)
+    "$SMASH" -c "$1" > "$WORK/output" 2>&1
+    status=$?
+    echo $((($(date +%s%N) - start) / 1000000))
+    return $status
+}
+ms=$(elapsed 'timeout 0.2 sleep 5')
+got=$?
+[ $got = 137 ] || fail "timeout 0.2 sleep 5: exit $got, expected 137 (SIGKILL)"
+[ "$ms" -ge 150 ] && [ "$ms" -lt 900 ] || fail "timeout 0.2 sleep 5 took ${ms}ms"
+grep -q '^smash: timeout 0.2 sleep 5 timed out!$' output || fail "timeout 0.2: $(cat output)"
+expect 0 'timeout 2 /bin/true'
+expect 3 'timeout 2 sh -c "exit 3"'
+
+# -k: SIGTERM when due, SIGKILL only if it is still there after the grace period
+expect 143 'timeout -k 1 0.1 sleep 5'
+ms=$(elapsed 'timeout -k 0.3 0.1 sh -c "trap \"\" TERM; sleep 5"')
+got=$?
+[ $got = 137 ] || fail "timeout -k ignoring TERM: exit $got, expected 137"
+[ "$ms" -ge 350 ] && [ "$ms" -lt 1500 ] || fail "timeout -k 0.3 0.1 took ${ms}ms"
+
+# background timeouts are all armed at once and fire in deadline order
+"$SMASH" -c 'timeout 0.4 sleep 5 &
+timeout 0.1 sleep 5 &
+timeout 3 sleep 0.1 &
+sleep 0.7
+jobs -v' > output 2>&1
+grep 'timed out' output > got
+printf '%s\n' 'smash: timeout 0.1 sleep 5 & timed out!' 'smash: timeout 0.4 sleep 5 & timed out!' > want
+cmp -s got want || fail "background timeouts:$(diff got want | head -n 6)"
+grep -q '^\[3\] timeout 3 sleep 0.1 & : [0-9]* done, exit status 0 ' output || fail "timeout 3 sleep 0.1 &: $(cat output)"
+
+for bad in 'timeout x sleep 1' 'timeout -1 sleep 1' 'timeout 0 sleep 1' 'timeout -k -1 1 sleep 1' 'timeout 1'; do
+    expect_match '^smash error: timeout: invalid arguments$' "$bad"
+done
+
+finish